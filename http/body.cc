@@ -0,0 +1,137 @@
+#include "body.h"
+
+size_t RequestBody::memory_limit_ = 64 * 1024;
+const char* RequestBody::tmp_dir_ = "/tmp";
+
+RequestBody::RequestBody() : file_fd_(-1), size_(0) {
+  pipe_[0] = pipe_[1] = -1;
+}
+
+RequestBody::~RequestBody() { Release(); }
+
+/* 清空内容，内存保留容量；临时文件直接关闭，下次需要时再创建 */
+void RequestBody::Init() {
+  data_.clear();
+  CloseFile();
+  size_ = 0;
+}
+
+void RequestBody::Release() {
+  Init();
+  std::string().swap(data_);
+  if (pipe_[0] >= 0) {
+    close(pipe_[0]);
+    close(pipe_[1]);
+    pipe_[0] = pipe_[1] = -1;
+  }
+}
+
+void RequestBody::Trim(size_t max_bytes) {
+  Init();
+  if (data_.capacity() > max_bytes) {
+    std::string().swap(data_);
+  }
+  // 只有大的主体才会用到管道，空闲时不占着两个描述符和内核缓冲区
+  if (pipe_[0] >= 0) {
+    close(pipe_[0]);
+    close(pipe_[1]);
+    pipe_[0] = pipe_[1] = -1;
+  }
+}
+
+void RequestBody::CloseFile() {
+  if (file_fd_ >= 0) {
+    close(file_fd_);
+    file_fd_ = -1;
+  }
+}
+
+bool RequestBody::Append(const char* data, size_t len) {
+  if (!IsSpilled() && size_ + len > memory_limit_ && !Spill()) {
+    return false;
+  }
+  if (IsSpilled()) {
+    while (len > 0) {
+      ssize_t n = ::write(file_fd_, data, len);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        LOG_ERROR("Write request body error: %d", errno);
+        return false;
+      }
+      data += n;
+      len -= n;
+      size_ += n;
+    }
+    return true;
+  }
+  data_.append(data, len);
+  size_ += len;
+  return true;
+}
+
+/* 创建临时文件，把已在内存中的部分写进去 */
+bool RequestBody::Spill() {
+  if (IsSpilled()) {
+    return true;
+  }
+  // O_TMPFILE创建的文件没有名字，不支持时退回mkstemp后立即unlink
+  file_fd_ = open(tmp_dir_, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (file_fd_ < 0) {
+    std::string path = std::string(tmp_dir_) + "/body.XXXXXX";
+    file_fd_ = mkostemp(&path[0], O_CLOEXEC);
+    if (file_fd_ < 0) {
+      LOG_ERROR("Create request body file error: %d", errno);
+      return false;
+    }
+    unlink(path.data());
+  }
+  std::string data;
+  data.swap(data_);
+  size_ = 0;
+  return Append(data.data(), data.size());
+}
+
+ssize_t RequestBody::Splice(int fd, size_t len, int* __errno) {
+  assert(IsSpilled());
+  if (pipe_[0] < 0 && pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+    *__errno = errno;
+    return -1;
+  }
+  ssize_t n = splice(fd, nullptr, pipe_[1], nullptr, len,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n <= 0) {
+    *__errno = errno;
+    return n;
+  }
+  // 管道中的数据全部写进文件，写文件不会返回EAGAIN
+  ssize_t left = n;
+  while (left > 0) {
+    ssize_t m = splice(pipe_[0], nullptr, file_fd_, nullptr, left,
+                       SPLICE_F_MOVE);
+    if (m <= 0) {
+      if (m < 0 && errno == EINTR) {
+        continue;
+      }
+      *__errno = m < 0 ? errno : EIO;
+      LOG_ERROR("Splice request body error: %d", *__errno);
+      return -1;
+    }
+    left -= m;
+  }
+  size_ += n;
+  return n;
+}
+
+ssize_t RequestBody::Read(size_t offset, char* buf, size_t len) const {
+  if (offset >= size_) {
+    return 0;
+  }
+  len = std::min(len, size_ - offset);
+  if (IsSpilled()) {
+    return pread(file_fd_, buf, len, offset);
+  }
+  data_.copy(buf, len, offset);
+  return len;
+}
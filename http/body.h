@@ -0,0 +1,65 @@
+#ifndef BODY_H
+#define BODY_H
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>  // open, splice
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "../log/logger.h"
+
+/* 请求主体的存放处
+不超过memory_limit_时放在内存中，超过后转存到临时文件(已unlink，关闭即删除)，
+大的主体还可以用splice从套接字经管道直接写入临时文件，不经过用户态。
+Init只清空内容，内存保留容量，临时文件关闭
+*/
+class RequestBody {
+ public:
+  RequestBody();
+  ~RequestBody();
+
+  void Init();
+  /* 在Init基础上释放内存和管道 */
+  void Release();
+  /* 连接空闲时调用，在Init基础上只释放超过max_bytes的内存和转存用的管道 */
+  void Trim(size_t max_bytes);
+
+  /* 追加主体数据，超过内存上限时转存到临时文件，失败返回false */
+  bool Append(const char* data, size_t len);
+
+  /* 立即转存到临时文件，已知主体较大时使用 */
+  bool Spill();
+
+  /* 从套接字fd读取最多len字节直接写入临时文件，返回读到的字节数，须先Spill */
+  ssize_t Splice(int fd, size_t len, int* __errno);
+
+  /* 从offset处读取最多len字节，供处理函数分段读取，返回读到的字节数 */
+  ssize_t Read(size_t offset, char* buf, size_t len) const;
+
+  inline size_t Size() const { return size_; }
+  inline bool IsSpilled() const { return file_fd_ >= 0; }
+  // 内存中的主体，转存到文件后为空
+  inline const std::string& GetData() const { return data_; }
+  // 转存后的临时文件
+  inline int GetFd() const { return file_fd_; }
+
+  // 内存中最多存放的字节数
+  static size_t memory_limit_;
+  // 临时文件所在目录
+  static const char* tmp_dir_;
+
+ private:
+  void CloseFile();
+
+  std::string data_;
+  int file_fd_;
+  int pipe_[2];
+  size_t size_;
+};
+
+#endif
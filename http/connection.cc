@@ -3,25 +3,50 @@
 const char* HttpConnection::resources_dir_;
 std::atomic<int> HttpConnection::user_count_;
 bool HttpConnection::ET;
+bool HttpConnection::use_sendfile_;
+bool HttpConnection::use_sql_;
+std::atomic<uint64_t> HttpConnection::total_bytes_sent_;
+std::atomic<uint64_t> HttpConnection::total_write_calls_;
 
 /* 初始化文件描述符、地址信息、关闭状态 */
 HttpConnection::HttpConnection() {
   fd_ = -1;
   addr_ = {0};
   closed_ = true;
+  n_iov_ = iov_idx_ = 0;
+  to_write_ = 0;
+  bytes_sent_ = n_write_calls_ = 0;
+  n_response_ = n_request_ = 0;
+  keep_alive_ = false;
+  n_part_ = 0;
+  waiting_ = false;
+  dispatched_ = false;
 }
 
 HttpConnection::~HttpConnection() { Close(); }
 
 void HttpConnection::Init(int fd, const sockaddr_in& addr) {
   assert(fd > 0);
+  bool closed = closed_.load(std::memory_order_acquire);
+  assert(closed);
+  (void)closed;
   // 线程安全，无需加锁
   user_count_++;
   addr_ = addr;
   fd_ = fd;
   write_buffer_.Reset();
   read_buffer_.Reset();
-  closed_ = false;
+  // 槽位复用时不能残留上一个连接未写完的响应和未解析完的请求
+  n_iov_ = iov_idx_ = 0;
+  to_write_ = 0;
+  bytes_sent_ = n_write_calls_ = 0;
+  n_response_ = n_request_ = 0;
+  keep_alive_ = false;
+  n_part_ = 0;
+  waiting_ = false;
+  dispatched_.store(false, std::memory_order_relaxed);
+  request_.Init();
+  closed_.store(false, std::memory_order_relaxed);
   LOG_INFO("Client[%d](%s: %d) connected, users: %d", fd_, GetIp(), GetPort(),
            static_cast<int>(user_count_));
 }
@@ -37,62 +62,213 @@ int HttpConnection::GetPort() const { return addr_.sin_port; }
 /* 获取套接字 */
 int HttpConnection::GetFd() const { return fd_; };
 
-/* 关闭连接 */
+/* 关闭连接
+槽位按fd索引，多个反应堆共享连接表，close之后同一个fd可能立即被其他反应堆accept，
+并在这个槽位上重新Init，所以清理和日志都在前面完成，close(fd_)放在最后
+*/
 void HttpConnection::Close() {
-    response_.UnmapFile();
-    if(closed_ == false){
-        closed_ = true; 
+    if(!closed_.load(std::memory_order_relaxed)){
+        waiting_ = false;
         user_count_--;
-        close(fd_);
+        for (int i = 0; responses_ && i < n_response_; i++) {
+            responses_[i].UnmapFile();
+        }
+        to_write_ = 0;
+        // 未处理的数据丢弃，空闲槽位不占用内存
+        read_buffer_.Reset();
+        ReleaseIdle();
+        uint64_t total_bytes = total_bytes_sent_ += bytes_sent_;
+        uint64_t total_calls = total_write_calls_ += n_write_calls_;
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIp(), GetPort(), (int)user_count_);
+        LOG_DEBUG("Client[%d] sent %zu bytes in %zu calls, bytes/syscall: %.1f (all: %.1f)",
+                  fd_, bytes_sent_, n_write_calls_,
+                  n_write_calls_ ? (double)bytes_sent_ / n_write_calls_ : 0.0,
+                  total_calls ? (double)total_bytes / total_calls : 0.0);
+        int fd = fd_;
+        closed_.store(true, std::memory_order_release);
+        close(fd);
     }
 }
 
-bool HttpConnection::Process() {
-  request_.Init();
-  // 没有读取到内容，处理失败
-  if (read_buffer_.GetReadableBytes() <= 0) return false;
+/* 释放连接占用的内存：缓冲区存储还给块池，请求和响应中的字符串、文件引用也释放，
+只剩连接对象本身，收到下一个请求时再重新分配。
+由反应堆的空闲定时器在连接空闲一段时间后调用，关闭时也调用
+*/
+void HttpConnection::ReleaseIdle() {
+  assert(to_write_ == 0 && read_buffer_.GetReadableBytes() == 0);
+  read_buffer_.Release();
+  write_buffer_.Release();
+  request_.Release();
+  responses_.reset();
+  n_response_ = 0;
+}
 
-  // 读取到内容就可以开始解析了
-  if (request_.Parse(read_buffer_)) {
-    LOG_DEBUG("%s", request_.GetPath().c_str());
-    // 解析成功
-    response_.Init(resources_dir_, request_.GetPath(), request_.IsKeepAlive(),
-                   200);
-  } else {
-    // 请求内容有误，应返回4xx响应码
-    response_.Init(resources_dir_, request_.GetPath(), false, 400);
+/* 持久连接处理完一批请求后调用
+常规大小的缓冲区、字符串和响应对象留给下一个请求，不在每个请求上分配和释放，
+真正空闲的连接由ReleaseIdle整个释放；这里只释放大请求、大响应留下的超出
+kIdleKeepBytes的存储，以及响应持有的文件引用，不让已淘汰或已修改的文件一直占着内存
+*/
+void HttpConnection::TrimIdle() {
+  assert(to_write_ == 0 && read_buffer_.GetReadableBytes() == 0);
+  if (read_buffer_.GetCapacity() > kIdleKeepBytes) {
+    read_buffer_.Release();
+  }
+  write_buffer_.Trim(kIdleKeepBytes / ChunkPool::kChunkSize);
+  request_.Trim(kIdleKeepBytes);
+  for (int i = 0; responses_ && i < kMaxPipeline; i++) {
+    responses_[i].UnmapFile();
   }
+  n_response_ = 0;
+}
 
-  // 开始响应
-  response_.MakeResponse(write_buffer_);
+/* 处理读缓冲区中所有完整的请求(最多kMaxPipeline个)，响应按请求顺序排队
+有响应要写时返回true；遇到需要查询数据库的请求时返回false，
+IsWaiting()为true，已排队的响应等查询返回后随后面的响应一起发送
+*/
+bool HttpConnection::Process() {
+  assert(to_write_ == 0 && !waiting_);
+  n_response_ = 0;
+  n_part_ = 0;
+  keep_alive_ = true;
+  return ProcessRequests();
+}
 
-  // 响应头
-  iov_[0].iov_base = const_cast<char*>(write_buffer_.NextReadable());
-  iov_[0].iov_len = write_buffer_.GetReadableBytes();
-  n_iov_ = 1;
+bool HttpConnection::Resume(bool verified) {
+  assert(waiting_);
+  waiting_ = false;
+  request_.SetUserVerified(verified);
+  AddResponse(true);
+  return ProcessRequests();
+}
 
-  // 响应内容
-  if (response_.GetFileLength() > 0 && response_.GetFile()) {
-    iov_[1].iov_base = response_.GetFile();
-    iov_[1].iov_len = response_.GetFileLength();
-    n_iov_ = 2;
+bool HttpConnection::ProcessRequests() {
+  /* 每个分段最多占用文字和文件两块，文字跨过写缓冲区的块边界时再多占一块，
+  一个响应的文字不超过一个块，最多再跨一个边界
+  */
+  while (n_response_ < kMaxPipeline && keep_alive_ &&
+         2 * (n_part_ + HttpResponse::kMaxRanges) +
+                 write_buffer_.GetUsedChunks() + 1 <=
+             kMaxIov &&
+         (read_buffer_.GetReadableBytes() > 0 || request_.IsBodyReceived())) {
+    if (!responses_) {
+      responses_.reset(new HttpResponse[kMaxPipeline]);
+    }
+    if (!request_.Parse(read_buffer_)) {
+      AddResponse(false);
+      continue;
+    }
+    // 请求还不完整，已解析的部分保留在request_中，等待更多数据
+    if (!request_.IsFinished()) {
+      break;
+    }
+    if (request_.GetUserAction() != HttpRequest::USER_NONE) {
+      // 请求和它指向的读缓冲区保持不动，查询返回后由Resume继续
+      if (use_sql_) {
+        waiting_ = true;
+        return false;
+      }
+      request_.SetUserVerified(true);
+    }
+    AddResponse(true);
+  }
+  if (n_response_ == 0) {
+    // 没有待处理的数据，连接空闲到下一次可读
+    if (read_buffer_.GetReadableBytes() == 0 && request_.IsIdle()) {
+      TrimIdle();
+    }
+    return false;
+  }
+
+  // 写缓冲区中的文字不会移动，按块切成iovec
+  size_t text_begin = 0;
+  n_iov_ = iov_idx_ = 0;
+  for (int i = 0; i < n_response_; i++) {
+    HttpResponse& response = responses_[i];
+    for (int j = 0; j < response.GetPartCount(); j++) {
+      const HttpResponse::Part& part = response.GetPart(j);
+      // 文件段之前的文字，相邻响应之间的文字合并在一起
+      n_iov_ += write_buffer_.GetIov(text_begin, part.text_end, iov_ + n_iov_,
+                                     kMaxIov - n_iov_);
+      text_begin = part.text_end;
+      if (response.GetFileFd() >= 0) {
+        // sendfile模式，文件内容不经过用户态
+        iov_[n_iov_].iov_base = nullptr;
+        file_blocks_[n_iov_].fd = response.GetFileFd();
+        file_blocks_[n_iov_].end = part.offset + part.len;
+      } else {
+        iov_[n_iov_].iov_base = response.GetFile() + part.offset;
+      }
+      iov_[n_iov_].iov_len = part.len;
+      n_iov_++;
+    }
+  }
+  n_iov_ += write_buffer_.GetIov(text_begin, header_end_[n_response_ - 1],
+                                 iov_ + n_iov_, kMaxIov - n_iov_);
+  assert(n_iov_ <= kMaxIov);
+  to_write_ = 0;
+  for (int i = 0; i < n_iov_; i++) {
+    to_write_ += iov_[i].iov_len;
   }
 
-  LOG_DEBUG("Response succeed. Filesize: %d, %d  to %d",
-            response_.GetFileLength(), n_iov_, ToWriteBytes());
+  LOG_DEBUG("Response succeed. %d responses, %zu bytes to write", n_response_,
+            ToWriteBytes());
   return true;
 }
 
-/* 读取用户发送的请求内容 */
+/* 为刚解析完的请求生成响应，parsed为false表示请求有误 */
+void HttpConnection::AddResponse(bool parsed) {
+  HttpResponse& response = responses_[n_response_];
+  if (parsed) {
+    LOG_DEBUG("%s", request_.GetPath().c_str());
+    // 解析成功，达到单个连接的请求数上限后关闭
+    n_request_++;
+    keep_alive_ = request_.IsKeepAlive() &&
+                  n_request_ < HttpResponse::keep_alive_max_;
+    response.Init(resources_dir_, request_.GetPath(), keep_alive_, 200,
+                  request_.GetAcceptEncoding());
+    if (request_.GetMethod().Equals("GET") ||
+        request_.GetMethod().Equals("HEAD")) {
+      response.SetPreconditions(
+          request_.GetHeader(HttpRequest::HEADER_IF_NONE_MATCH),
+          request_.GetHeader(HttpRequest::HEADER_IF_MODIFIED_SINCE));
+      response.SetRange(request_.GetHeader(HttpRequest::HEADER_RANGE),
+                        request_.GetHeader(HttpRequest::HEADER_IF_RANGE));
+    }
+    if (request_.GetMethod().Equals("HEAD")) {
+      response.SetHeadOnly();
+    }
+  } else {
+    // 请求内容有误，应返回4xx响应码，之后的数据无法再分出请求，响应后关闭
+    keep_alive_ = false;
+    response.Init(resources_dir_, request_.GetPath(), false, 400);
+  }
+
+  // 开始响应，条件请求头指向请求，生成响应后才能重置请求
+  response.MakeResponse(write_buffer_, use_sendfile_);
+  request_.Init();
+  n_part_ += response.GetPartCount();
+  header_end_[n_response_++] = write_buffer_.GetReadableBytes();
+}
+
+/* 读取用户发送的请求内容
+边缘触发时每次最多读kReadBudget字节，剩下的重新注册事件后再读，
+一个大的上传不会长时间占住线程，读缓冲区也不会无限增长
+*/
 ssize_t HttpConnection::read(int* __errno) {
   ssize_t sz = -1;
+  size_t total = 0;
   do {
-    sz = read_buffer_.ReadFd(fd_, __errno);
+    if (read_buffer_.GetReadableBytes() == 0 && request_.CanSpliceBody()) {
+      // 大的请求主体直接从套接字转存到临时文件
+      sz = request_.SpliceBody(fd_, __errno);
+    } else {
+      sz = read_buffer_.ReadFd(fd_, __errno);
+    }
     if (sz <= 0) {
       break;
     }
-  } while (ET);
+    total += sz;
+  } while (ET && total < kReadBudget);
   return sz;
 }
 
@@ -102,36 +278,67 @@ ssize_t HttpConnection::write(int* __errno) {
   2. 将write_buff内容转移到客户对应的文件描述符中（本函数做的事）
   */
   do {
-    // 聚集写，将iov的所有块写入到fd中，返回写入字节数
-    // 需要手动更新iov_base和iov_len
-    sz = writev(fd_, iov_, n_iov_);
+    if (IsFileBlock(iov_idx_)) {
+      // sendfile模式的文件段，偏移量由结束位置和剩余长度算出，EAGAIN后从这里继续
+      const FileBlock& block = file_blocks_[iov_idx_];
+      off_t offset = block.end - iov_[iov_idx_].iov_len;
+      sz = sendfile(fd_, block.fd, &offset, iov_[iov_idx_].iov_len);
+    } else {
+      // 连续的内存块一次聚集写出
+      int end = iov_idx_;
+      while (end < n_iov_ && !IsFileBlock(end)) {
+        end++;
+      }
+      if (end < n_iov_) {
+        /* 后面紧跟sendfile时带MSG_MORE发送，相当于只对这一次调用开启TCP_CORK，
+        响应头会和文件的第一段合并成一个报文，不需要额外的setsockopt
+        */
+        struct msghdr msg = {0};
+        msg.msg_iov = iov_ + iov_idx_;
+        msg.msg_iovlen = end - iov_idx_;
+        sz = sendmsg(fd_, &msg, MSG_MORE);
+      } else {
+        sz = writev(fd_, iov_ + iov_idx_, n_iov_ - iov_idx_);
+      }
+    }
+    n_write_calls_++;
     // 写入失败
     if (sz <= 0) {
-      *__errno = errno;
+      // 只有sendfile会返回0：文件在发送期间被截断，读不到剩余的内容，
+      // 此时errno是之前留下的值，可能是EAGAIN，不能继续等待可写
+      *__errno = sz == 0 ? EIO : errno;
       break;
     }
-    // 无可写入内容，传输结束
-    if (iov_[0].iov_len + iov_[1].iov_len == 0) {
-      break;
+    bytes_sent_ += sz;
+    AdvanceIov(sz);
+  } while (to_write_ > 0 && (ET || to_write_ > 10240));
+  return sz;
+}
+
+/* 已写出sz字节，跳过写完的块并更新剩余块的首地址 */
+void HttpConnection::AdvanceIov(size_t sz) {
+  assert(sz <= to_write_);
+  to_write_ -= sz;
+  while (iov_idx_ < n_iov_) {
+    struct iovec& iov = iov_[iov_idx_];
+    size_t n = std::min(sz, iov.iov_len);
+    if (iov.iov_base) {
+      iov.iov_base = (uint8_t*)iov.iov_base + n;
     }
-    // 写入字节超出第一块，说明有部分字节写入了第二块
-    else if (static_cast<size_t>(sz) > iov_[0].iov_len) {
-      // 移动首地址到未写入部分
-      iov_[1].iov_base = (uint8_t*)iov_[1].iov_base + (sz - iov_[0].iov_len);
-      // 更新剩余字节数
-      iov_[1].iov_len -= (sz - iov_[0].iov_len);
-      // 第二块写完了第一块一定也写完了
-      if (iov_[0].iov_len) {
-        write_buffer_.Reset();
-        iov_[0].iov_len = 0;
-      }
-    } else {
-      // 第一块还没写完，第二块一定还没开始，所以不用管第二块
-      iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + sz;
-      iov_[0].iov_len -= sz;
-      // 更新写入缓冲区的偏移量
-      write_buffer_.MoveReadPos(sz);
+    iov.iov_len -= n;
+    sz -= n;
+    if (iov.iov_len > 0) {
+      break;
     }
-  } while (ET || ToWriteBytes() > 10240);
-  return sz;
-}
\ No newline at end of file
+    iov_idx_++;
+  }
+  // 全部写完，写缓冲区中的响应头不再需要
+  if (to_write_ == 0) {
+    write_buffer_.Reset();
+  }
+}
+
+/* 追加已由内核读到的请求数据 */
+void HttpConnection::AppendReadBuffer(const char* data, size_t len) {
+  read_buffer_.Append(data, len);
+}
@@ -1,16 +1,21 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
 #include <arpa/inet.h>
 #include <errno.h>
-#include <mysql/mysql.h>
 #include <netinet/in.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 
+#include <algorithm>
 #include <atomic>
-#include <regex>
+#include <memory>
 #include <string>
 #include <unordered_map>
 
 #include "../log/logger.h"
 #include "../utils/buffer.h"
+#include "../utils/chainbuffer.h"
 #include "request.h"
 #include "response.h"
 
@@ -18,36 +23,128 @@ using std::string;
 using std::unordered_map;
 
 class HttpConnection {
+ public:
+  // 一次最多处理的流水线请求数，其余的留在读缓冲区中下次处理
+  static const int kMaxPipeline = 8;
+  // 空闲时每个缓冲区、字符串最多保留的存储，超出的部分释放
+  static const size_t kIdleKeepBytes = ChunkPool::kChunkSize;
+  // 边缘触发时一次可读事件最多读取的字节数
+  static const size_t kReadBudget = 256 * 1024;
+  // 待写出的块数上限，保证一批中最后一个响应也能放下最多的分段
+  static const int kMaxIov = 2 * (kMaxPipeline + HttpResponse::kMaxRanges) + 4;
+
+ private:
+  // sendfile模式的内容块
+  inline bool IsFileBlock(int i) const {
+    return iov_[i].iov_base == nullptr && iov_[i].iov_len > 0;
+  }
+
  private:
   int fd_;
   struct sockaddr_in addr_;
-  bool closed_;
-  struct iovec iov_[2];
+  /* 关闭时最后以release写入，Init先以acquire读取：fd被其他反应堆复用时，
+  Close对槽位的清理先于新连接的Init
+  */
+  std::atomic<bool> closed_;
+  /* 待写出的块，写缓冲区中的文字(响应头、分段头)与文件段交替
+  sendfile模式下文件段的iov_base为nullptr，iov_len为剩余长度，
+  文件和这一段的结束偏移量记在file_blocks_的同一下标处
+  */
+  struct FileBlock {
+    int fd;
+    off_t end;
+  };
+  struct iovec iov_[kMaxIov];
+  FileBlock file_blocks_[kMaxIov];
   int n_iov_;
-  // 读写缓冲区
+  int iov_idx_;      // 第一个没写完的块
+  size_t to_write_;  // 剩余字节数
+  // 本连接写出的字节数和写系统调用次数
+  size_t bytes_sent_;
+  size_t n_write_calls_;
+  /* 读缓冲区连续存放，请求解析直接在其中进行；
+  写缓冲区只存放响应头等文字，由块串成，追加时不移动已有内容
+  */
   Buffer read_buffer_;
-  Buffer write_buffer_;
+  ChainBuffer write_buffer_;
   HttpRequest request_;
-  HttpResponse response_;
+  // 一批流水线请求的响应，按请求顺序发送；占用较大，第一次处理请求时才分配，关闭时释放
+  std::unique_ptr<HttpResponse[]> responses_;
+  int n_response_;
+  // 本连接已处理的请求数
+  int n_request_;
+  // 最后一个响应是否保持连接
+  bool keep_alive_;
+  // 本批各响应在写缓冲区中的结束位置和文件段总数
+  size_t header_end_[kMaxPipeline];
+  int n_part_;
+  // 有请求在等待数据库查询的结果，期间不读也不写
+  bool waiting_;
+  // 已交给工作线程处理
+  std::atomic<bool> dispatched_;
+
+  bool ProcessRequests();
+  void AddResponse(bool parsed);
 
  public:
   HttpConnection();
   ~HttpConnection();
   void Init(int fd, const sockaddr_in &addr);
   bool Process();
+  /* 查询结果返回后继续处理，之后的流水线请求也一并处理，返回值与Process相同 */
+  bool Resume(bool verified);
   ssize_t read(int *__errno);
   ssize_t write(int *__errno);
   static bool ET;
+  static bool use_sendfile_;
+  // 登录、注册需要查询数据库，为false时直接通过
+  static bool use_sql_;
   static const char *resources_dir_;
   static std::atomic<int> user_count_;
+  // 所有已关闭连接的写出字节数和写系统调用次数，用于比较两种发送方式
+  static std::atomic<uint64_t> total_bytes_sent_;
+  static std::atomic<uint64_t> total_write_calls_;
 
  public:
   void Close();
+  void ReleaseIdle();
+  void TrimIdle();
 
  public:
   const char *GetIp() const;
   int GetPort() const;
   int GetFd() const;
-  inline int ToWriteBytes() { return iov_[0].iov_len + iov_[1].iov_len; }
-  inline bool IsKeepAlive() const { return request_.IsKeepAlive(); }
-};
\ No newline at end of file
+  inline size_t ToWriteBytes() const { return to_write_; }
+  inline bool IsKeepAlive() const { return keep_alive_; }
+  inline bool IsClosed() const {
+    return closed_.load(std::memory_order_acquire);
+  }
+  inline bool IsWaiting() const { return waiting_; }
+  // 请求都已处理完、响应都已写完，也不在等待查询
+  inline bool IsIdle() const {
+    return to_write_ == 0 && read_buffer_.GetReadableBytes() == 0 &&
+           request_.IsIdle() && !waiting_;
+  }
+  /* 线程池模式下由反应堆线程在提交任务前置位，工作线程把连接交还给epoll前清除，
+  置位期间反应堆线程的定时器不能访问连接的其他状态；
+  两边都用acq_rel交换，工作线程对连接的修改对反应堆线程和下一个工作线程可见
+  */
+  inline void SetDispatched(bool dispatched) {
+    dispatched_.exchange(dispatched, std::memory_order_acq_rel);
+  }
+  inline bool IsDispatched() const {
+    return dispatched_.load(std::memory_order_acquire);
+  }
+  inline string GetUserQuery(std::vector<string>* params) const {
+    return request_.GetUserQuery(params);
+  }
+
+  /* 供完成式(io_uring)后端使用：数据由内核读入别处，写由内核直接使用iov */
+  void AppendReadBuffer(const char *data, size_t len);
+  inline size_t GetReadBytes() const { return read_buffer_.GetReadableBytes(); }
+  inline const struct iovec *GetIov() const { return iov_ + iov_idx_; }
+  inline int GetIovCnt() const { return n_iov_ - iov_idx_; }
+  void AdvanceIov(size_t sz);
+};
+
+#endif
\ No newline at end of file
@@ -4,66 +4,341 @@
 const unordered_set<string> HttpRequest::kAvaiableHtml{
     "/index", "/register", "/login", "/welcome", "/video", "/picture"};
 
+const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG{
+    {"/register.html", USER_REGISTER}, {"/login.html", USER_LOGIN}};
+
+size_t HttpRequest::max_body_size_ = 64 * 1024 * 1024;
+
+/* 常用请求头的完美哈希表，下标为(长度 + 首字母*29 + 末字母) & 31，字母不区分大小写
+表中的请求头两两不冲突，新增时需重新挑选系数
+*/
+const HttpRequest::HeaderEntry HttpRequest::kHeaderTable[32] = {
+    {"Host", 4, HEADER_HOST},
+    {nullptr, 0, HEADER_COUNT},
+    {"Cookie", 6, HEADER_COOKIE},
+    {"Referer", 7, HEADER_REFERER},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {"Content-Type", 12, HEADER_CONTENT_TYPE},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {"Expect", 6, HEADER_EXPECT},
+    {nullptr, 0, HEADER_COUNT},
+    {"Content-Length", 14, HEADER_CONTENT_LENGTH},
+    {"Keep-Alive", 10, HEADER_KEEP_ALIVE},
+    {"Connection", 10, HEADER_CONNECTION},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {"If-Range", 8, HEADER_IF_RANGE},
+    {"Accept-Encoding", 15, HEADER_ACCEPT_ENCODING},
+    {"Range", 5, HEADER_RANGE},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {"Accept", 6, HEADER_ACCEPT},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {"If-None-Match", 13, HEADER_IF_NONE_MATCH},
+    {"If-Modified-Since", 17, HEADER_IF_MODIFIED_SINCE},
+    {"Transfer-Encoding", 17, HEADER_TRANSFER_ENCODING},
+    {nullptr, 0, HEADER_COUNT},
+    {nullptr, 0, HEADER_COUNT},
+    {"User-Agent", 10, HEADER_USER_AGENT},
+};
+
 /* 初始化各个参数 */
 void HttpRequest::Init() {
-  method_ = path_ = version_ = body_ = "";
+  path_.clear();
+  method_ = version_ = body_ = Span();
   state_ = REQUEST_LINE;
-  header_.clear();
+  line_begin_ = scanned_ = head_end_ = 0;
+  content_length_ = 0;
+  chunked_ = false;
+  streaming_ = false;
+  head_.clear();
+  body_store_.Init();
+  body_remain_ = chunk_remain_ = 0;
+  base_ = nullptr;
+  known_mask_ = 0;
+  n_others_ = 0;
   post_.clear();
+  user_action_ = USER_NONE;
 }
 
-/* 解析请求 */
+void HttpRequest::Release() {
+  Init();
+  string().swap(path_);
+  string().swap(head_);
+  unordered_map<string, string>().swap(post_);
+  body_store_.Release();
+}
+
+void HttpRequest::Trim(size_t max_bytes) {
+  Init();
+  if (path_.capacity() > max_bytes) {
+    string().swap(path_);
+  }
+  if (head_.capacity() > max_bytes) {
+    string().swap(head_);
+  }
+  body_store_.Trim(max_bytes);
+}
+
+/* 解析请求
+有限状态机，直接在读缓冲区上解析，只记录各字段的偏移量，不拷贝。
+先用Scanner找到请求头结尾的空行确定请求头的边界，再逐行解析请求行和请求头；
+数据不完整时记下查找到的位置，读入更多数据后从这里继续，不重复查找；
+解析完一个请求后才从读缓冲区中取走它，停在下一个请求的开头
+返回false表示请求有误
+*/
 bool HttpRequest::Parse(Buffer& buff) {
-  static const string kCrlf = "\r\n";
-  // 无可读内容
-  if (buff.GetReadableBytes() < 0) return false;
-
-  // 有限状态机
-  while (buff.GetReadableBytes() > 0 && state_ != FINISH) {
-    // 未读的区间是read_pos到write_pos这一段
-    const char* line_end =
-        std::search(buff.NextReadable(), buff.NextWriteableConst(),
-                    kCrlf.cbegin(), kCrlf.cend());
-    // 取一行
-    string line(buff.NextReadable(), line_end);
-    // 根据当前状态匹配解析
+  if (state_ == FINISH) {
+    return true;
+  }
+  if (streaming_) {
+    if (!ParseStreamBody(buff)) {
+      return false;
+    }
+    if (state_ == FINISH) {
+      Finish(buff);
+    }
+    return true;
+  }
+
+  const char* base = buff.NextReadable();
+  const char* end = buff.NextWriteableConst();
+  size_t readable = buff.GetReadableBytes();
+
+  while (state_ == REQUEST_LINE || state_ == HEADERS) {
+    if (head_end_ == 0) {
+      // 跳过请求之间多余的空行
+      while (line_begin_ < readable &&
+             (base[line_begin_] == '\r' || base[line_begin_] == '\n')) {
+        line_begin_++;
+      }
+      // 空行可能被拆在两次读入中，从上次查找的位置往回3个字节开始
+      size_t from = std::max(line_begin_, scanned_ >= 3 ? scanned_ - 3 : 0);
+      const char* head_end = Scanner::FindHeaderEnd(base + from, end);
+      size_t head_length = (head_end ? head_end - base : readable) - line_begin_;
+      if (head_length > kMaxHeaderLength) {
+        LOG_WARN("Request header too long");
+        return false;
+      }
+      if (!head_end) {
+        scanned_ = readable;
+        return true;
+      }
+      head_end_ = head_end - base;
+    }
+    // 请求头已完整，根据当前状态逐行解析
+    bool ok = state_ == REQUEST_LINE ? ParseRequestLine(base, base + head_end_)
+                                     : ParseHeader(base, base + head_end_);
+    if (!ok) {
+      return false;
+    }
+  }
+
+  if (state_ == BODY && !chunked_ &&
+      content_length_ <= RequestBody::memory_limit_ &&
+      readable - line_begin_ >= content_length_) {
+    // 较小的主体已经随请求头一起到达，直接指向读缓冲区
+    body_ = Span(line_begin_, content_length_);
+    line_begin_ += content_length_;
+    state_ = FINISH;
+  }
+  if (state_ == FINISH) {
+    Finish(buff);
+    return true;
+  }
+  // 其余情况流式接收主体
+  StartStreaming(buff);
+  return Parse(buff);
+}
+
+/* 把请求头拷贝出来并从读缓冲区中取走，读缓冲区之后只用来接收主体 */
+void HttpRequest::StartStreaming(Buffer& buff) {
+  head_.assign(buff.NextReadable(), line_begin_);
+  buff.MoveReadPos(line_begin_);
+  line_begin_ = 0;
+  streaming_ = true;
+  body_remain_ = content_length_;
+  // 已知主体超过内存上限时直接转存到临时文件，之后可以splice
+  if (!chunked_ && content_length_ > RequestBody::memory_limit_) {
+    body_store_.Spill();
+  }
+}
+
+/* 边收边解析主体，解析过的数据立即从读缓冲区中取走，数据不够时返回true等待 */
+bool HttpRequest::ParseStreamBody(Buffer& buff) {
+  while (state_ != FINISH) {
+    const char* data = buff.NextReadable();
+    size_t readable = buff.GetReadableBytes();
     switch (state_) {
-      case REQUEST_LINE:
-        // 请求行有错误
-        if (!ParseRequestLine(line)) return false;
+      case BODY:
+        if (!ConsumeBody(buff, &body_remain_)) {
+          return false;
+        }
+        if (body_remain_ > 0) {
+          return true;
+        }
+        state_ = FINISH;
         break;
-      case HEADERS:
-        ParseHeader(line);
-        // 可能没有body，可以直接结束
-        if (buff.GetReadableBytes() <= 2) state_ = FINISH;
+      case CHUNK_SIZE:
+      case CHUNK_TRAILER: {
+        const char* lf = Scanner::FindByte(data, data + readable, '\n');
+        if (lf == data + readable) {
+          if (readable > kMaxChunkLineLength) {
+            LOG_WARN("Chunk line too long");
+            return false;
+          }
+          return true;
+        }
+        size_t line_len = lf - data;
+        if (line_len > 0 && data[line_len - 1] == '\r') {
+          line_len--;
+        }
+        buff.MoveReadPtr(lf + 1);
+        if (state_ == CHUNK_TRAILER) {
+          // trailer中的字段忽略，空行表示主体结束
+          if (line_len == 0) {
+            content_length_ = body_store_.Size();
+            state_ = FINISH;
+          }
+          break;
+        }
+        // 十六进制的块大小，后面可能跟;扩展
+        size_t size = 0;
+        size_t i = 0;
+        for (; i < line_len; i++) {
+          char c = data[i] | 0x20;
+          int digit;
+          if (c >= '0' && c <= '9') {
+            digit = c - '0';
+          } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+          } else {
+            break;
+          }
+          if (size > (max_body_size_ >> 4)) {
+            return false;
+          }
+          size = size * 16 + digit;
+        }
+        if (i == 0 || (i < line_len && data[i] != ';' && data[i] != ' ')) {
+          return false;
+        }
+        if (body_store_.Size() + size > max_body_size_) {
+          LOG_WARN("Request body too large");
+          return false;
+        }
+        chunk_remain_ = size;
+        state_ = size > 0 ? CHUNK_DATA : CHUNK_TRAILER;
         break;
-      case BODY:
-        ParseBody(line);
+      }
+      case CHUNK_DATA:
+        if (!ConsumeBody(buff, &chunk_remain_)) {
+          return false;
+        }
+        if (chunk_remain_ > 0) {
+          return true;
+        }
+        state_ = CHUNK_DATA_END;
         break;
-      default:
+      case CHUNK_DATA_END:
+        if (readable == 0 || (data[0] == '\r' && readable < 2)) {
+          return true;
+        }
+        if (data[0] == '\n') {
+          buff.MoveReadPos(1);
+        } else if (data[0] == '\r' && data[1] == '\n') {
+          buff.MoveReadPos(2);
+        } else {
+          return false;
+        }
+        state_ = CHUNK_SIZE;
         break;
+      default:
+        return false;
     }
-    if (line_end == buff.NextWriteable()) break;
-    buff.MoveReadPtr(line_end + 2);
   }
+  return true;
+}
 
-  LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(),
-            version_.c_str());
+/* 把读缓冲区中最多remain字节存入主体 */
+bool HttpRequest::ConsumeBody(Buffer& buff, size_t* remain) {
+  size_t len = std::min(buff.GetReadableBytes(), *remain);
+  if (len == 0) {
+    return true;
+  }
+  if (!body_store_.Append(buff.NextReadable(), len)) {
+    return false;
+  }
+  buff.MoveReadPos(len);
+  *remain -= len;
   return true;
 }
 
-/* 解析请求行 */
-bool HttpRequest::ParseRequestLine(const string& line) {
-  std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-  std::smatch subMatch;
+ssize_t HttpRequest::SpliceBody(int fd, int* __errno) {
+  assert(CanSpliceBody());
+  ssize_t len = body_store_.Splice(fd, body_remain_, __errno);
+  if (len > 0) {
+    body_remain_ -= len;
+  }
+  return len;
+}
+
+/* 请求解析完成，确定切片的基址，没有流式接收时从读缓冲区中取走整个请求 */
+void HttpRequest::Finish(Buffer& buff) {
+  if (streaming_) {
+    base_ = head_.data();
+  } else {
+    base_ = buff.NextReadable();
+    buff.MoveReadPos(line_begin_);
+  }
+  if (content_length_ > 0) {
+    ParseBody();
+  }
+  LOG_DEBUG("[%.*s], [%s], [%.*s]", (int)method_.len, base_ + method_.begin,
+            path_.c_str(), (int)version_.len, base_ + version_.begin);
+}
+
+StrSlice HttpRequest::GetBody() const {
+  if (!streaming_) {
+    return Slice(body_);
+  }
+  if (body_store_.IsSpilled()) {
+    return StrSlice();
+  }
+  return StrSlice(body_store_.GetData().data(), body_store_.Size());
+}
+
+/* 解析请求行：请求类型 资源路径 HTTP/版本 */
+bool HttpRequest::ParseRequestLine(const char* base, const char* head_end) {
+  static const char kDelims[] = {' ', '\n'};
+  const char* line = base + line_begin_;
+  // 请求头完整，行尾一定在head_end之前
+  const char* lf = Scanner::FindByte(line, head_end, '\n');
+  assert(lf != head_end);
+  const char* line_end = (lf > line && lf[-1] == '\r') ? lf - 1 : lf;
+
   /* 取出请求类型、资源路径、HTTP版本*/
-  if (!regex_match(line, subMatch, patten)) {
+  const char* method_end = Scanner::FindAny(line, line_end, kDelims, 1);
+  const char* path = method_end + 1;
+  const char* path_end =
+      method_end < line_end ? Scanner::FindAny(path, line_end, kDelims, 1)
+                            : line_end;
+  const char* version = path_end + 1;
+  if (method_end == line || path_end == line_end || path_end == path ||
+      line_end - version <= 5 || memcmp(version, "HTTP/", 5) != 0 ||
+      Scanner::FindByte(version, line_end, ' ') != line_end) {
+    LOG_ERROR("RequestLine Error: %.*s", (int)(line_end - line), line);
     return false;
-    LOG_ERROR("RequestLine Error: %s", line.c_str());
   }
-  method_ = subMatch[1];
-  path_ = subMatch[2];
-  version_ = subMatch[3];
+  method_ = Span(line_begin_, method_end - line);
+  version_ = Span(version + 5 - base, line_end - version - 5);
+  path_.assign(path, path_end - path);
+  line_begin_ = lf + 1 - base;
 
   /* 解析路径， 加上html后缀 */
   if (path_ == "/") {  // 根目录默认为index.html
@@ -78,35 +353,261 @@ bool HttpRequest::ParseRequestLine(const string& line) {
   return true;
 }
 
-/* 解析请求头 */
-void HttpRequest::ParseHeader(const string& line) {
-  std::regex patten("^([^:]*): ?(.*)$");
-  std::smatch subMatch;
-  if (regex_match(line, subMatch, patten)) {
-    header_[subMatch[1]] = subMatch[2];
+/* 解析请求头：名字: 值，空行表示请求头结束
+冒号和行尾一次查找，不必先找行尾再回头找冒号
+*/
+bool HttpRequest::ParseHeader(const char* base, const char* head_end) {
+  static const char kDelims[] = {':', '\n'};
+  const char* line = base + line_begin_;
+  const char* p = Scanner::FindAny(line, head_end, kDelims, 2);
+  assert(p != head_end);
+  if (*p == '\n') {
+    // 没有冒号的行只能是请求头结尾的空行
+    if (p - line > 1 || (p - line == 1 && *line != '\r')) {
+      return false;
+    }
+    line_begin_ = p + 1 - base;
+    return ParseFraming(base);
+  }
+  const char* colon = p;
+  if (colon == line) {
+    return false;
+  }
+  const char* lf = Scanner::FindByte(colon + 1, head_end, '\n');
+  assert(lf != head_end);
+  // 去掉值两端的空白
+  const char* value = colon + 1;
+  while (value < lf && (*value == ' ' || *value == '\t')) value++;
+  const char* value_end = lf;
+  while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t' ||
+                               value_end[-1] == '\r')) {
+    value_end--;
+  }
+  Span name(line_begin_, colon - line);
+  Span span(value - base, value_end - value);
+  HEADER_ID id = LookupHeader(line, colon - line);
+  if (id != HEADER_COUNT) {
+    if (!(known_mask_ & (1u << id))) {
+      known_[id] = span;
+      known_mask_ |= 1u << id;
+    } else if (id == HEADER_CONTENT_LENGTH) {
+      // 重复的Content-Length可能被用来夹带请求
+      return false;
+    }
   } else {
-    state_ = BODY;
+    if (n_others_ >= kMaxOtherHeaders) {
+      LOG_WARN("Too many request headers");
+      return false;
+    }
+    others_[n_others_++] = std::make_pair(name, span);
+  }
+  line_begin_ = lf + 1 - base;
+  return true;
+}
+
+HttpRequest::HEADER_ID HttpRequest::LookupHeader(const char* name,
+                                                 size_t len) {
+  if (len == 0) {
+    return HEADER_COUNT;
+  }
+  unsigned h = (len + (name[0] | 0x20) * 29u + (name[len - 1] | 0x20)) & 31;
+  const HeaderEntry& entry = kHeaderTable[h];
+  if (entry.name && entry.len == len &&
+      strncasecmp(entry.name, name, len) == 0) {
+    return entry.id;
+  }
+  return HEADER_COUNT;
+}
+
+/* 请求头结束，根据Transfer-Encoding和Content-Length确定主体的长度 */
+bool HttpRequest::ParseFraming(const char* base) {
+  StrSlice encoding = FindHeader(base, HEADER_TRANSFER_ENCODING);
+  StrSlice length = FindHeader(base, HEADER_CONTENT_LENGTH);
+  if (encoding.data) {
+    // 只支持chunked；同时带Content-Length的请求可能被用来夹带请求
+    if (!encoding.EqualsNoCase("chunked") || length.data) {
+      LOG_WARN("Unsupported Transfer-Encoding: %.*s", (int)encoding.len,
+               encoding.data);
+      return false;
+    }
+    chunked_ = true;
+    state_ = CHUNK_SIZE;
+    return true;
   }
+  for (size_t i = 0; i < length.len; i++) {
+    if (length.data[i] < '0' || length.data[i] > '9' ||
+        content_length_ > max_body_size_) {
+      return false;
+    }
+    content_length_ = content_length_ * 10 + (length.data[i] - '0');
+  }
+  if (content_length_ > max_body_size_) {
+    LOG_WARN("Request body too large: %zu", content_length_);
+    return false;
+  }
+  state_ = content_length_ > 0 ? BODY : FINISH;
+  return true;
 }
 
-/* 判断是否持久连接 */
+StrSlice HttpRequest::FindHeader(const char* base, const char* name) const {
+  size_t len = strlen(name);
+  HEADER_ID id = LookupHeader(name, len);
+  if (id != HEADER_COUNT) {
+    return FindHeader(base, id);
+  }
+  for (int i = 0; i < n_others_; i++) {
+    const Span& header = others_[i].first;
+    if (header.len == len && strncasecmp(base + header.begin, name, len) == 0) {
+      return StrSlice(base + others_[i].second.begin, others_[i].second.len);
+    }
+  }
+  return StrSlice();
+}
+
+StrSlice HttpRequest::GetHeader(const char* name) const {
+  return base_ ? FindHeader(base_, name) : StrSlice();
+}
+
+/* 判断是否持久连接
+HTTP/1.1默认保持连接，除非Connection: close；HTTP/1.0需要显式的Connection: keep-alive
+*/
 bool HttpRequest::IsKeepAlive() const {
-  if (header_.count("Connection") > 0) {
-    return header_.find("Connection")->second == "keep-alive" &&
-           version_ == "1.1";
+  StrSlice connection = GetHeader(HEADER_CONNECTION);
+  if (GetVersion().Equals("1.1")) {
+    return !connection.data || !connection.EqualsNoCase("close");
   }
-  return false;
+  return connection.data && connection.EqualsNoCase("keep-alive");
+}
+
+/* 解析Accept-Encoding，如"gzip, deflate;q=0.5, br;q=0"
+q为0表示不接受，*表示其他没有列出的编码都接受
+*/
+int HttpRequest::GetAcceptEncoding() const {
+  StrSlice value = GetHeader(HEADER_ACCEPT_ENCODING);
+  int accepted = 0;
+  int listed = 0;
+  bool star = false;
+  const char* p = value.data;
+  const char* end = value.data + value.len;
+  while (p < end) {
+    const char* item_end = Scanner::FindByte(p, end, ',');
+    const char* name_end = Scanner::FindByte(p, item_end, ';');
+    // 去掉名字两边的空白
+    while (p < name_end && (*p == ' ' || *p == '\t')) {
+      p++;
+    }
+    const char* q = name_end;
+    while (q > p && (q[-1] == ' ' || q[-1] == '\t')) {
+      q--;
+    }
+    StrSlice name(p, q - p);
+    // q=0、q=0.0等全零的权重表示不接受
+    bool zero = false;
+    const char* param = Scanner::FindByte(name_end, item_end, '=');
+    if (param < item_end && param > name_end &&
+        (param[-1] == 'q' || param[-1] == 'Q')) {
+      zero = true;
+      for (const char* c = param + 1; c < item_end; c++) {
+        if (*c != '0' && *c != '.' && *c != ' ' && *c != '\t') {
+          zero = false;
+          break;
+        }
+      }
+    }
+    int bit = 0;
+    if (name.EqualsNoCase("gzip") || name.EqualsNoCase("x-gzip")) {
+      bit = 1 << Compressor::ENCODING_GZIP;
+    } else if (name.EqualsNoCase("br")) {
+      bit = 1 << Compressor::ENCODING_BR;
+    } else if (name.Equals("*")) {
+      star = !zero;
+    }
+    listed |= bit;
+    if (!zero) {
+      accepted |= bit;
+    }
+    p = item_end + 1;
+  }
+  if (star) {
+    accepted |= ~listed & ((1 << Compressor::ENCODING_COUNT) - 1) &
+                ~(1 << Compressor::ENCODING_IDENTITY);
+  }
+  return accepted;
 }
 
 /* 解析主体 */
-void HttpRequest::ParseBody(const string& line) {
-  body_ = line;
-  // 用户提交了表单，在本例是登录
-  if (method_ == "POST" &&
-      header_["Content-Type"] == "application/x-www-form-urlencoded") {
-    /* 暂不作校验，直接返回welcome页面 */
-    path_ = "/welcome.html";
-  }
-  state_ = FINISH;
-  LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
-}
\ No newline at end of file
+void HttpRequest::ParseBody() {
+  StrSlice body = GetBody();
+  // 用户提交了表单，登录和注册需要查询数据库，由连接提交查询后再确定页面
+  if (GetMethod().Equals("POST") &&
+      GetHeader(HEADER_CONTENT_TYPE).Equals("application/x-www-form-urlencoded")) {
+    if (body.data) {
+      ParseFromUrlencoded(body.data, body.len);
+    }
+    auto tag = DEFAULT_HTML_TAG.find(path_);
+    if (tag == DEFAULT_HTML_TAG.end()) {
+      path_ = "/welcome.html";
+    } else if (post_["username"].empty() || post_["password"].empty()) {
+      path_ = "/error.html";
+    } else {
+      user_action_ = static_cast<USER_ACTION>(tag->second);
+    }
+  }
+  LOG_DEBUG("Body:%.*s, len:%zu", (int)body.len, body.data ? body.data : "",
+            content_length_);
+}
+
+/* 解析key1=value1&key2=value2 */
+void HttpRequest::ParseFromUrlencoded(const char* data, size_t len) {
+  const char* end = data + len;
+  while (data < end) {
+    const char* item_end = Scanner::FindByte(data, end, '&');
+    const char* eq = Scanner::FindByte(data, item_end, '=');
+    string& value = post_[UrlDecode(data, eq)];
+    if (eq < item_end) {
+      value = UrlDecode(eq + 1, item_end);
+    }
+    data = item_end + 1;
+  }
+}
+
+/* +还原为空格，%XX还原为对应字节 */
+string HttpRequest::UrlDecode(const char* begin, const char* end) {
+  string decoded;
+  decoded.reserve(end - begin);
+  for (const char* p = begin; p < end; p++) {
+    if (*p == '+') {
+      decoded.push_back(' ');
+    } else if (*p == '%' && end - p > 2 && isxdigit(p[1]) && isxdigit(p[2])) {
+      char hex[3] = {p[1], p[2], '\0'};
+      decoded.push_back(static_cast<char>(strtol(hex, nullptr, 16)));
+      p += 2;
+    } else {
+      decoded.push_back(*p);
+    }
+  }
+  return decoded;
+}
+
+/* 用户名和密码作为参数，由执行查询的数据库连接转义后代替?；
+注册时用户名已存在则不插入，影响的行数为0
+*/
+string HttpRequest::GetUserQuery(std::vector<string>* params) const {
+  assert(user_action_ != USER_NONE);
+  const string& user = post_.at("username");
+  const string& password = post_.at("password");
+  if (user_action_ == USER_LOGIN) {
+    *params = {user, password};
+    return "SELECT 1 FROM user WHERE username=? AND password=? LIMIT 1";
+  }
+  *params = {user, password, user};
+  return "INSERT INTO user(username, password) SELECT ?,? FROM DUAL "
+         "WHERE NOT EXISTS (SELECT 1 FROM user WHERE username=?)";
+}
+
+void HttpRequest::SetUserVerified(bool verified) {
+  LOG_DEBUG("User %s %s", post_["username"].c_str(),
+            verified ? "verified" : "rejected");
+  path_ = verified ? "/welcome.html" : "/error.html";
+  user_action_ = USER_NONE;
+}
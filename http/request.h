@@ -1,19 +1,27 @@
 #ifndef REQUEST_H
 #define REQUEST_H
 
+#include <ctype.h>  // isxdigit
 #include <errno.h>
-#include <mysql/mysql.h>  //mysql
+#include <stdint.h>
+#include <stdlib.h>  // strtol
+#include <string.h>
+#include <strings.h>      // strncasecmp
 
 #include <algorithm>
-#include <regex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "../log/logger.h"
-#include "../pool/sqlconn.h"
 #include "../pool/sqlconnpool.h"
 #include "../utils/buffer.h"
+#include "../utils/compressor.h"
+#include "../utils/scanner.h"
+#include "../utils/strslice.h"
+#include "body.h"
 
 using std::string;
 using std::unordered_map;
@@ -34,12 +42,17 @@ using std::unordered_set;
 3. 空行
 3. 请求数据（主体）
 */
+
 class HttpRequest {
  public:
   enum PARSE_STATE {
     REQUEST_LINE,
     HEADERS,
-    BODY,
+    BODY,            // 按Content-Length读取主体
+    CHUNK_SIZE,      // chunked编码：块大小行
+    CHUNK_DATA,      // 块数据
+    CHUNK_DATA_END,  // 块数据后的\r\n
+    CHUNK_TRAILER,   // 最后一块之后的trailer，以空行结束
     FINISH,
   };
 
@@ -54,31 +67,171 @@ class HttpRequest {
     CLOSED_CONNECTION,
   };
 
+  /* 需要查询数据库才能确定响应的表单 */
+  enum USER_ACTION {
+    USER_NONE = 0,
+    USER_REGISTER,
+    USER_LOGIN,
+  };
+
+  /* 常用请求头，通过完美哈希直接对应到固定槽位 */
+  enum HEADER_ID {
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_KEEP_ALIVE,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_EXPECT,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_IF_RANGE,
+    HEADER_USER_AGENT,
+    HEADER_REFERER,
+    HEADER_COOKIE,
+    HEADER_COUNT,
+  };
+
   HttpRequest() { Init(); }
   ~HttpRequest() = default;
 
   void Init();
+  /* 连接关闭时调用，在Init基础上释放字符串和主体占用的内存 */
+  void Release();
+  /* 连接空闲时调用，只释放超过max_bytes的字符串和主体内存 */
+  void Trim(size_t max_bytes);
   bool Parse(Buffer& buff);
 
   inline string& GetPath() { return path_; };
   inline const string GetPath() const { return path_; };
   bool IsKeepAlive() const;
+  // 可接受的内容编码，按(1 << Compressor::ENCODING)置位
+  int GetAcceptEncoding() const;
+  // 已解析出一个完整的请求，读缓冲区中剩下的属于下一个请求
+  inline bool IsFinished() const { return state_ == FINISH; }
+  // 没有解析到一半的请求(读缓冲区中的部分除外)
+  inline bool IsIdle() const { return state_ == REQUEST_LINE && !streaming_; }
+
+  /* 以下切片指向读缓冲区，只在请求解析完成后、下一次读入数据前有效 */
+  inline StrSlice GetMethod() const { return Slice(method_); }
+  inline StrSlice GetVersion() const { return Slice(version_); }
+  // 主体在内存中时有效，转存到临时文件后data为nullptr，需通过GetBodyStore读取
+  StrSlice GetBody() const;
+  // 流式接收的主体，主体较小且随请求头一起到达时不使用
+  inline const RequestBody& GetBodyStore() const { return body_store_; }
+  inline size_t GetContentLength() const { return content_length_; }
+
+  /* 大的主体已转存到临时文件且读缓冲区已处理完时，可以用splice直接从套接字接收 */
+  inline bool CanSpliceBody() const {
+    return state_ == BODY && streaming_ && body_remain_ > 0 &&
+           body_store_.IsSpilled();
+  }
+  ssize_t SpliceBody(int fd, int* __errno);
+  // 主体已经全部接收，只差调用Parse完成解析
+  inline bool IsBodyReceived() const {
+    return state_ == BODY && streaming_ && body_remain_ == 0;
+  }
+
+  // 单个请求主体的最大字节数
+  static size_t max_body_size_;
+  // 按名字查找请求头(不区分大小写)，没有时data为nullptr
+  StrSlice GetHeader(const char* name) const;
+  inline StrSlice GetHeader(HEADER_ID id) const {
+    return base_ ? FindHeader(base_, id) : StrSlice();
+  }
+
+  // 常用请求头的编号，不是常用请求头时返回HEADER_COUNT
+  static HEADER_ID LookupHeader(const char* name, size_t len);
+
+  /* 登录、注册表单：解析完成后由连接提交GetUserQuery查询，
+  结果返回后调用SetUserVerified确定响应的页面
+  */
+  inline USER_ACTION GetUserAction() const { return user_action_; }
+  string GetUserQuery(std::vector<string>* params) const;
+  void SetUserVerified(bool verified);
 
  private:
-  bool ParseRequestLine(const string& line);
-  void ParseHeader(const string& line);
-  void ParseBody(const string& line);
+  /* 相对请求开头的偏移量，读缓冲区扩容或整理时请求开头之后的数据整体移动，偏移量仍然有效 */
+  struct Span {
+    Span() : begin(0), len(0) {}
+    Span(size_t b, size_t l) : begin(b), len(l) {}
+    size_t begin;
+    size_t len;
+  };
+  inline StrSlice Slice(const Span& span) const {
+    return base_ ? StrSlice(base_ + span.begin, span.len) : StrSlice();
+  }
+
+  bool ParseRequestLine(const char* base, const char* head_end);
+  bool ParseHeader(const char* base, const char* head_end);
+  bool ParseFraming(const char* base);
+  void StartStreaming(Buffer& buff);
+  bool ParseStreamBody(Buffer& buff);
+  bool ConsumeBody(Buffer& buff, size_t* remain);
+  void Finish(Buffer& buff);
+  void ParseBody();
+  void ParseFromUrlencoded(const char* data, size_t len);
+  static string UrlDecode(const char* begin, const char* end);
+  StrSlice FindHeader(const char* base, const char* name) const;
+  inline StrSlice FindHeader(const char* base, HEADER_ID id) const {
+    return (known_mask_ & (1u << id))
+               ? StrSlice(base + known_[id].begin, known_[id].len)
+               : StrSlice();
+  }
+
+  // 请求行和请求头的最大长度，超过时认为请求有误
+  static const size_t kMaxHeaderLength = 32768;
+  // 块大小行和trailer一行的最大长度
+  static const size_t kMaxChunkLineLength = 1024;
 
   // 解析状态
   PARSE_STATE state_;
-  // 请求类型、资源路径、HTTP版本、主体
-  string method_, path_, version_, body_;
-  // 请求头
-  unordered_map<string, string> header_;
+  // 当前行的开头和查找请求头结尾已经查找过的位置，数据不完整时下次从这里继续
+  size_t line_begin_;
+  size_t scanned_;
+  // 请求头结尾空行之后的位置，0表示请求头还不完整
+  size_t head_end_;
+  // 主体长度，来自Content-Length；chunked编码时为解码后的长度
+  size_t content_length_;
+  bool chunked_;
+  /* 主体较大、不完整或chunked编码时流式接收：
+  请求头拷贝到head_，从读缓冲区中取走，之后收到的主体边解析边存入body_store_
+  */
+  bool streaming_;
+  string head_;
+  RequestBody body_store_;
+  // Content-Length主体和当前块还没收到的字节数
+  size_t body_remain_;
+  size_t chunk_remain_;
+  // 请求解析完成后指向请求开头
+  const char* base_;
+  // 请求类型、HTTP版本、主体
+  Span method_, version_, body_;
+  // 资源路径，会被改写，需要拷贝
+  string path_;
+  // 常用请求头的值按编号存放，known_mask_记录出现过的
+  Span known_[HEADER_COUNT];
+  uint32_t known_mask_;
+  // 其他请求头的名字和值，数组内联在请求中，不需要分配内存
+  static const int kMaxOtherHeaders = 64;
+  std::pair<Span, Span> others_[kMaxOtherHeaders];
+  int n_others_;
+
+  struct HeaderEntry {
+    const char* name;
+    size_t len;
+    HEADER_ID id;
+  };
+  static const HeaderEntry kHeaderTable[32];
   // post内容
   unordered_map<string, string> post_;
+  USER_ACTION user_action_;
   // 可访问的资源路径
   static const unordered_set<string> kAvaiableHtml;
+  // 需要验证用户的表单页面，值为USER_ACTION
   static const unordered_map<string, int> DEFAULT_HTML_TAG;
 };
 
@@ -20,13 +20,18 @@ const unordered_map<string, string> HttpResponse::kSuffixToType = {
     {".tar", "application/x-tar"},
     {".css", "text/css "},
     {".js", "text/javascript "},
+    {".svg", "image/svg+xml"},
+    {".json", "application/json"},
 };
 
 const unordered_map<int, string> HttpResponse::kCodeToStatus = {
     {200, "OK"},
+    {206, "Partial Content"},
+    {304, "Not Modified"},
     {400, "Bad Request"},
     {403, "Forbidden"},
     {404, "Not Found"},
+    {416, "Range Not Satisfiable"},
 };
 
 const unordered_map<int, string> HttpResponse::kErrorCodeToPath = {
@@ -35,13 +40,21 @@ const unordered_map<int, string> HttpResponse::kErrorCodeToPath = {
     {404, "/404.html"},
 };
 
+int HttpResponse::keep_alive_max_ = 100;
+int HttpResponse::keep_alive_timeout_s_ = 0;
+
 HttpResponse::HttpResponse() {
   code_ = -1;
   path_ = "";
   resources_dir_ = "";
   keep_alive_ = false;
-  mmap_ptr = nullptr;
+  head_only_ = false;
+  use_sendfile_ = false;
   file_stat_ = {0};
+  accept_encoding_ = 0;
+  encoding_ = Compressor::ENCODING_IDENTITY;
+  multipart_ = false;
+  n_parts_ = 0;
 }
 
 /* 虚构函数只需要取消映射文件，没有其他资源要释放 */
@@ -49,29 +62,50 @@ HttpResponse::~HttpResponse() { UnmapFile(); }
 
 /* 初始化各参数 */
 void HttpResponse::Init(const string& resources_dir, string& path,
-                        bool keep_alive, int code) {
+                        bool keep_alive, int code, int accept_encoding) {
   assert(resources_dir != "");
-  if (mmap_ptr) {
-    UnmapFile();
-  }
+  UnmapFile();
   code_ = code;
   keep_alive_ = keep_alive;
+  head_only_ = false;
   path_ = path;
   resources_dir_ = resources_dir;
-  mmap_ptr = nullptr;
   file_stat_ = {0};
+  accept_encoding_ = accept_encoding;
+  encoding_ = Compressor::ENCODING_IDENTITY;
+  if_none_match_ = StrSlice();
+  if_modified_since_ = StrSlice();
+  range_ = StrSlice();
+  if_range_ = StrSlice();
+  multipart_ = false;
+  n_parts_ = 0;
 }
 
-/* 生成响应内容 */
-void HttpResponse::MakeResponse(Buffer& buff) {
+void HttpResponse::SetPreconditions(StrSlice if_none_match,
+                                    StrSlice if_modified_since) {
+  if_none_match_ = if_none_match;
+  if_modified_since_ = if_modified_since;
+}
+
+void HttpResponse::SetRange(StrSlice range, StrSlice if_range) {
+  range_ = range;
+  if_range_ = if_range;
+}
+
+/* 生成响应内容，use_sendfile为true时不映射文件，由连接用sendfile发送 */
+void HttpResponse::MakeResponse(ChainBuffer& buff, bool use_sendfile) {
+  use_sendfile_ = use_sendfile;
   /* 1.
   string有两个函数用于获取C风格的字符串：c_str()和data()，在c11之前，前者可以指向末位不为\0的字符串，在c11之后两者无区别
-  2. stat函数用于获取文件信息
+  2. 文件缓存中保存了stat结果，命中时不需要再调用stat
   3. S_ISDIR判断是否为目录
   这行代码主要是判断文件是否有效，无效即返回404
   */
-  if (stat((resources_dir_ + path_).data(), &file_stat_) < 0 ||
-      S_ISDIR(file_stat_.st_mode)) {
+  file_ = FileCache::Instance()->Get(resources_dir_ + path_);
+  if (file_) {
+    file_stat_ = file_->st;
+  }
+  if (!file_ || S_ISDIR(file_stat_.st_mode)) {
     code_ = 404;
   }
   /* 判断文件权限
@@ -93,20 +127,331 @@ void HttpResponse::MakeResponse(Buffer& buff) {
   // 4xx 错误
   if (kErrorCodeToPath.count(code_) > 0) {
     SetErrorHtml();
+  } else {
+    SelectEncoding();
+    // 客户端缓存的仍是最新的，只回复响应头，文件缓存命中时不需要任何系统调用
+    if (code_ == 200 && IsNotModified()) {
+      code_ = 304;
+    }
+  }
+  if_none_match_ = if_modified_since_ = StrSlice();
+  if (code_ == 200 && range_.data && MatchIfRange() &&
+      MakeRangeResponse(buff)) {
+    range_ = if_range_ = StrSlice();
+    return;
+  }
+  range_ = if_range_ = StrSlice();
+  // 文件有效时整个响应头只与文件、状态码和keep-alive有关，直接使用缓存的
+  if (file_ && file_->fd >= 0) {
+    AppendCachedHeader(buff);
+    if (code_ == 304 || head_only_) {
+      // 304和HEAD没有主体
+      file_.reset();
+      file_stat_ = {0};
+    } else {
+      AddPart(buff, 0, file_stat_.st_size);
+    }
+    return;
   }
   SetStateLine(buff);
   SetHeader(buff);
   SetContent(buff);
 }
 
+/* 按Accept-Encoding选择内容编码，只协商文本类的资源，br优先
+压缩版本也来自文件缓存，之后的发送与原文件相同；响应头缓存在压缩版本上。
+运行时压缩在后台进行，还没压缩好时发送原文件
+*/
+void HttpResponse::SelectEncoding() {
+  static const Compressor::ENCODING kPreferred[] = {Compressor::ENCODING_BR,
+                                                     Compressor::ENCODING_GZIP};
+  if (code_ != 200 || !file_ || file_->fd < 0 ||
+      !IsCompressible(GetFileType())) {
+    return;
+  }
+  for (Compressor::ENCODING encoding : kPreferred) {
+    if (!(accept_encoding_ & (1 << encoding))) {
+      continue;
+    }
+    FileCache::FilePtr file = FileCache::Instance()->GetEncoded(
+        resources_dir_ + path_, file_, encoding, true);
+    if (file) {
+      file_ = file;
+      file_stat_ = file->st;
+      encoding_ = encoding;
+      return;
+    }
+  }
+}
+
+/* 在写缓冲区当前位置之后发送文件的[offset, offset + len) */
+void HttpResponse::AddPart(ChainBuffer& buff, off_t offset, size_t len) {
+  assert(n_parts_ < kMaxRanges);
+  if (len == 0 || head_only_) {
+    return;
+  }
+  Part& part = parts_[n_parts_++];
+  part.text_end = buff.GetReadableBytes();
+  part.offset = offset;
+  part.len = len;
+}
+
+/* If-Range中的ETag(强比较)或日期与当前文件一致时Range才有效，不一致时发送整个文件 */
+bool HttpResponse::MatchIfRange() const {
+  if (!if_range_.data) {
+    return true;
+  }
+  const string& validator =
+      if_range_.data[0] == '"' ? file_->etag : file_->last_modified;
+  return if_range_.len == validator.size() &&
+         memcmp(if_range_.data, validator.data(), validator.size()) == 0;
+}
+
+/* 解析Range: bytes=0-499, 500-, -500，范围按请求顺序存入begin/end(都包含)
+返回可满足的范围数；格式错误或范围多于kMaxRanges时返回-1，忽略Range
+*/
+int HttpResponse::ParseRange(off_t size, off_t* begin, off_t* end) const {
+  static const char kUnit[] = "bytes=";
+  static const size_t kUnitLen = sizeof(kUnit) - 1;
+  if (range_.len < kUnitLen || strncasecmp(range_.data, kUnit, kUnitLen) != 0) {
+    return -1;
+  }
+  const char* p = range_.data + kUnitLen;
+  const char* last = range_.data + range_.len;
+  int n = 0;
+  while (p < last) {
+    const char* item_end = Scanner::FindByte(p, last, ',');
+    // 每个范围为first-last，省略first表示最后若干字节，省略last表示直到结尾
+    off_t value[2] = {-1, -1};
+    int field = 0;
+    for (; p < item_end; p++) {
+      char c = *p;
+      if (c >= '0' && c <= '9') {
+        off_t v = value[field] < 0 ? 0 : value[field];
+        if (v > (INT64_MAX - 9) / 10) {
+          return -1;
+        }
+        value[field] = v * 10 + (c - '0');
+      } else if (c == '-' && field == 0) {
+        field = 1;
+      } else if (c != ' ' && c != '\t') {
+        return -1;
+      }
+    }
+    p = item_end + 1;
+    off_t first = value[0];
+    off_t second = value[1];
+    if (field == 0 || (first < 0 && second < 0)) {
+      // 空项允许出现在列表中，其余格式错误
+      if (first < 0 && second < 0 && field == 0) {
+        continue;
+      }
+      return -1;
+    }
+    if (first < 0) {
+      // 后缀范围
+      if (second == 0 || size == 0) {
+        continue;
+      }
+      first = second >= size ? 0 : size - second;
+      second = size - 1;
+    } else {
+      if (second >= 0 && second < first) {
+        return -1;
+      }
+      if (first >= size) {
+        continue;
+      }
+      if (second < 0 || second >= size) {
+        second = size - 1;
+      }
+    }
+    if (n == kMaxRanges) {
+      return -1;
+    }
+    begin[n] = first;
+    end[n] = second;
+    n++;
+  }
+  return n;
+}
+
+/* 按Range生成206或416响应，Range无效应发送整个文件时返回false
+范围相关的响应头不缓存，只有一个范围时直接发送该段，多个时以multipart/byteranges分段发送
+*/
+bool HttpResponse::MakeRangeResponse(ChainBuffer& buff) {
+  if (!file_ || file_->fd < 0) {
+    return false;
+  }
+  off_t size = file_stat_.st_size;
+  off_t begin[kMaxRanges];
+  off_t end[kMaxRanges];
+  int n = ParseRange(size, begin, end);
+  if (n < 0) {
+    return false;
+  }
+  if (n == 0) {
+    code_ = 416;
+    SetStateLine(buff);
+    SetHeader(buff);
+    buff.Append("Content-Range: bytes */" + std::to_string(size) + "\r\n");
+    buff.Append("Content-length: 0\r\n\r\n");
+    file_.reset();
+    file_stat_ = {0};
+    return true;
+  }
+  code_ = 206;
+  string range_end = "/" + std::to_string(size) + "\r\n";
+  if (n == 1) {
+    SetStateLine(buff);
+    SetHeader(buff);
+    buff.Append("Content-Range: bytes " + std::to_string(begin[0]) + "-" +
+                std::to_string(end[0]) + range_end);
+    buff.Append("Content-length: " + std::to_string(end[0] - begin[0] + 1) +
+                "\r\n\r\n");
+    AddPart(buff, begin[0], end[0] - begin[0] + 1);
+    return true;
+  }
+
+  // 分段头和结尾的分隔符也计入Content-length，要先全部生成
+  static std::atomic<uint64_t> boundary_seq(0);
+  char boundary[24];
+  snprintf(boundary, sizeof(boundary), "%020llu",
+           static_cast<unsigned long long>(++boundary_seq));
+  multipart_ = true;
+  boundary_ = boundary;
+  string part_headers[kMaxRanges];
+  string closing = "\r\n--" + boundary_ + "--\r\n";
+  size_t length = closing.size();
+  for (int i = 0; i < n; i++) {
+    part_headers[i] = "\r\n--" + boundary_ + "\r\nContent-Type: " +
+                      GetFileType() + "\r\nContent-Range: bytes " +
+                      std::to_string(begin[i]) + "-" + std::to_string(end[i]) +
+                      range_end + "\r\n";
+    length += part_headers[i].size() + (end[i] - begin[i] + 1);
+  }
+  SetStateLine(buff);
+  SetHeader(buff);
+  buff.Append("Content-length: " + std::to_string(length) + "\r\n\r\n");
+  if (head_only_) {
+    return true;
+  }
+  for (int i = 0; i < n; i++) {
+    buff.Append(part_headers[i]);
+    AddPart(buff, begin[i], end[i] - begin[i] + 1);
+  }
+  buff.Append(closing);
+  return true;
+}
+
+/* 追加缓存在文件上的响应头，第一次用到时生成 */
+void HttpResponse::AppendCachedHeader(ChainBuffer& buff) {
+  int slot = HeaderSlot();
+  const std::string* header = file_->GetHeader(slot);
+  if (!header) {
+    ChainBuffer tmp;
+    SetStateLine(tmp);
+    SetHeader(tmp);
+    SetContent(tmp);
+    header = file_->SetHeader(slot, new std::string(tmp.RetrieveAllToStr()));
+  }
+  buff.Append(*header);
+}
+
+/* 响应头在CachedFile中的位置 */
+int HttpResponse::HeaderSlot() const {
+  int index;
+  switch (code_) {
+    case 200:
+      index = 0;
+      break;
+    case 304:
+      index = 1;
+      break;
+    case 400:
+      index = 2;
+      break;
+    case 403:
+      index = 3;
+      break;
+    default:
+      index = 4;
+      break;
+  }
+  return index * 2 + (keep_alive_ ? 1 : 0);
+}
+
+/* 判断客户端缓存的版本是否仍有效
+有If-None-Match时只比较ETag，没有时才比较If-Modified-Since
+*/
+bool HttpResponse::IsNotModified() const {
+  if (!file_ || file_->fd < 0) {
+    return false;
+  }
+  if (if_none_match_.data) {
+    return MatchEtag(if_none_match_, file_->etag);
+  }
+  if (if_modified_since_.data) {
+    // 浏览器一般原样带回Last-Modified，相同时不需要解析日期
+    const string& last_modified = file_->last_modified;
+    if (if_modified_since_.len == last_modified.size() &&
+        memcmp(if_modified_since_.data, last_modified.data(),
+               last_modified.size()) == 0) {
+      return true;
+    }
+    struct tm tm = {};
+    string date = if_modified_since_.ToString();
+    const char* end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return end && *end == '\0' && file_->st.st_mtim.tv_sec <= timegm(&tm);
+  }
+  return false;
+}
+
+/* If-None-Match为逗号分隔的ETag列表或*，使用弱比较，忽略W/前缀 */
+bool HttpResponse::MatchEtag(StrSlice list, const string& etag) {
+  const char* p = list.data;
+  const char* end = list.data + list.len;
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+      p++;
+    }
+    if (p == end) {
+      break;
+    }
+    if (*p == '*') {
+      return true;
+    }
+    if (end - p >= 2 && p[0] == 'W' && p[1] == '/') {
+      p += 2;
+    }
+    // ETag带引号，其中不能有逗号
+    const char* tag_end = Scanner::FindByte(p, end, ',');
+    const char* q = tag_end;
+    while (q > p && (q[-1] == ' ' || q[-1] == '\t')) {
+      q--;
+    }
+    if (static_cast<size_t>(q - p) == etag.size() &&
+        memcmp(p, etag.data(), etag.size()) == 0) {
+      return true;
+    }
+    p = tag_end;
+  }
+  return false;
+}
+
 /* 设置错误页面路径 */
 void HttpResponse::SetErrorHtml() {
   path_ = kErrorCodeToPath.find(code_)->second;
-  stat((resources_dir_ + path_).data(), &file_stat_);
+  file_ = FileCache::Instance()->Get(resources_dir_ + path_);
+  if (file_) {
+    file_stat_ = file_->st;
+  } else {
+    file_stat_ = {0};
+  }
 }
 
 /* 设置错误页面 */
-void HttpResponse::SetErrorContent(Buffer& buff, string message) {
+void HttpResponse::SetErrorContent(ChainBuffer& buff, string message) {
   string body;
   string status;
   body += "<html><title>Error</title>";
@@ -121,11 +466,13 @@ void HttpResponse::SetErrorContent(Buffer& buff, string message) {
   body += "<hr><em>TinyWebServer</em></body></html>";
 
   buff.Append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
-  buff.Append(body);
+  if (!head_only_) {
+    buff.Append(body);
+  }
 }
 
 /* 设置状态行 */
-void HttpResponse::SetStateLine(Buffer& buff) {
+void HttpResponse::SetStateLine(ChainBuffer& buff) {
   // 需能够处理所有响应码
   assert(kCodeToStatus.count(code_) > 0);
   string status = kCodeToStatus.find(code_)->second;
@@ -134,64 +481,85 @@ void HttpResponse::SetStateLine(Buffer& buff) {
 }
 
 /* 设置响应头 */
-void HttpResponse::SetHeader(Buffer& buff) {
+void HttpResponse::SetHeader(ChainBuffer& buff) {
   buff.Append("Connection: ");
-  // if (keep_alive_) {
-  //   buff.Append("keep-alive\r\n");
-  //   buff.Append("keep-alive: max=6, timeout=120\r\n");
-  // } else {
-  //   buff.Append("close\r\n");
-  // }
-  buff.Append("close\r\n");
-  buff.Append("Content-type: " + GetFileType() + "\r\n");
+  if (keep_alive_) {
+    buff.Append("keep-alive\r\n");
+    buff.Append("Keep-Alive: max=" + std::to_string(keep_alive_max_));
+    if (keep_alive_timeout_s_ > 0) {
+      buff.Append(", timeout=" + std::to_string(keep_alive_timeout_s_));
+    }
+    buff.Append("\r\n");
+  } else {
+    buff.Append("close\r\n");
+  }
+  if (multipart_) {
+    buff.Append("Content-type: multipart/byteranges; boundary=" + boundary_ +
+                "\r\n");
+  } else {
+    buff.Append("Content-type: " + GetFileType() + "\r\n");
+  }
+  if (encoding_ != Compressor::ENCODING_IDENTITY) {
+    buff.Append("Content-Encoding: ");
+    buff.Append(Compressor::GetName(encoding_));
+    buff.Append("\r\n");
+  }
+  // 同一路径的响应因Accept-Encoding而不同，缓存需要区分
+  bool success = code_ == 200 || code_ == 206 || code_ == 304;
+  if (success && IsCompressible(GetFileType())) {
+    buff.Append("Vary: Accept-Encoding\r\n");
+  }
+  if (success && file_ && file_->fd >= 0) {
+    buff.Append("ETag: " + file_->etag + "\r\n");
+    buff.Append("Last-Modified: " + file_->last_modified + "\r\n");
+    buff.Append("Accept-Ranges: bytes\r\n");
+  }
 }
 
 /* 设置响应内容 */
-void HttpResponse::SetContent(Buffer& buff) {
-  // 只读模式打开文件
-  int fp = open((resources_dir_ + path_).data(), O_RDONLY);
-  if (fp < 0) {
+void HttpResponse::SetContent(ChainBuffer& buff) {
+  // 文件缓存打开失败或映射失败
+  if (!file_ || file_->fd < 0) {
+    file_.reset();
+    file_stat_ = {0};
     SetErrorContent(buff, "File NotFound!");
     return;
   }
-
-  /* mmap将文件映射到内存提高文件的访问速度，0指示系统自动选取首地址，PROT_READ表示可读取，MAP_PRIVATE建立一个写入时拷贝的私有映射，对该区域的任何修改都不会写回原来的文件内容
-   */
+  /* 文件由缓存以只读私有映射打开并保持fd，多个响应共享同一份
+  sendfile模式发送fd，内容在内核中直接从页缓存拷贝到套接字；否则发送映射的内存
+  */
   LOG_DEBUG("file path %s", (resources_dir_ + path_).data());
-  int* ret = (int*)mmap(0, file_stat_.st_size, PROT_READ, MAP_PRIVATE, fp, 0);
-  if (*ret == -1) {
-    // 映射失败
-    SetErrorContent(buff, "File Not Found!");
+  if (code_ == 304) {
+    buff.Append("\r\n");
     return;
   }
-  mmap_ptr = (char*)ret;
-  // 要记得关闭文件
-  close(fp);
   buff.Append("Content-length: " + std::to_string(file_stat_.st_size) +
               "\r\n\r\n");
 }
 
-/* 取消映射文件 */
-void HttpResponse::UnmapFile() {
-  if (mmap_ptr) {
-    munmap(mmap_ptr, file_stat_.st_size);
-    mmap_ptr = nullptr;
-  }
-}
+/* 释放对缓存文件的引用，最后一个引用释放时才真正取消映射、关闭文件 */
+void HttpResponse::UnmapFile() { file_.reset(); }
 
 /* 获取文件类型 */
-string HttpResponse::GetFileType() {
+const string& HttpResponse::GetFileType() {
+  static const string kDefaultType = "text/plain";
   // 判断文件类型
   string::size_type idx = path_.find_last_of('.');
   // 没有后缀，默认为纯文本
   if (idx == string::npos) {
-    return "text/plain";
+    return kDefaultType;
   }
   // 能找到该类型
-  string suffix = path_.substr(idx);
-  if (kSuffixToType.count(suffix) == 1) {
-    return kSuffixToType.find(suffix)->second;
+  auto it = kSuffixToType.find(path_.substr(idx));
+  if (it != kSuffixToType.end()) {
+    return it->second;
   }
   // 其他默认为纯文本
-  return "text/plain";
-}
\ No newline at end of file
+  return kDefaultType;
+}
+
+/* 文本类的内容压缩效果好，图片、音视频和压缩包本身已经压缩过 */
+bool HttpResponse::IsCompressible(const string& type) {
+  return type.compare(0, 5, "text/") == 0 || type == "image/svg+xml" ||
+         type == "application/json" || type == "application/xhtml+xml";
+}
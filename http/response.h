@@ -1,54 +1,112 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
-#include <fcntl.h>     // open
-#include <sys/mman.h>  // mmap, munmap
 #include <sys/stat.h>  // stat
-#include <unistd.h>    // close
+#include <time.h>      // strptime, timegm
 
 #include <unordered_map>
 
 #include "../log/logger.h"
-#include "../utils/buffer.h"
+#include "../utils/chainbuffer.h"
+#include "../utils/compressor.h"
+#include "../utils/filecache.h"
+#include "../utils/scanner.h"
+#include "../utils/strslice.h"
 
 using std::string;
 using std::unordered_map;
 class HttpResponse {
  public:
+  /* 内容中的一段文件，前面是写缓冲区中text_end之前还没发送的文字(响应头或分段头) */
+  struct Part {
+    size_t text_end;  // 相对写缓冲区可读开头
+    off_t offset;
+    size_t len;
+  };
+  // 一个响应最多的分段数，Range中的范围更多时发送整个文件
+  static const int kMaxRanges = 8;
+
   HttpResponse();
   ~HttpResponse();
 
+  /* accept_encoding为客户端可接受的内容编码，按(1 << Compressor::ENCODING)置位 */
   void Init(const std::string& srcDir, std::string& path,
-            bool isKeepAlive = false, int code = -1);
-  void MakeResponse(Buffer& buff);
+            bool isKeepAlive = false, int code = -1, int accept_encoding = 0);
+  /* 条件请求头，指向读缓冲区，只在下一次MakeResponse中使用 */
+  void SetPreconditions(StrSlice if_none_match, StrSlice if_modified_since);
+  void SetRange(StrSlice range, StrSlice if_range);
+  /* HEAD请求只生成响应头，Content-length与GET相同，不发送任何主体 */
+  inline void SetHeadOnly() { head_only_ = true; }
+  void MakeResponse(ChainBuffer& buff, bool use_sendfile = false);
   void UnmapFile();
 
   // 获取状态码
   inline int GetCode() const { return code_; }
 
   // 获取文件映射后的内存指针
-  inline char* GetFile() { return mmap_ptr; };
+  inline char* GetFile() {
+    return file_ && !use_sendfile_ ? file_->data : nullptr;
+  };
+
+  // 获取sendfile模式下打开的文件描述符
+  inline int GetFileFd() const {
+    return file_ && use_sendfile_ ? file_->fd : -1;
+  }
 
   // 获取文件长度
   inline size_t GetFileLength() const { return file_stat_.st_size; }
 
+  // 要发送的文件段，按顺序与写缓冲区中的文字交替发送
+  inline int GetPartCount() const { return n_parts_; }
+  inline const Part& GetPart(int i) const { return parts_[i]; }
+
+  // 单个持久连接最多处理的请求数，以及Keep-Alive头中通告的空闲超时(秒，0表示不通告)
+  static int keep_alive_max_;
+  static int keep_alive_timeout_s_;
+
  private:
   void SetErrorHtml();
-  void SetStateLine(Buffer& buff);
-  void SetHeader(Buffer& buff);
-  void SetContent(Buffer& buff);
-  void SetErrorContent(Buffer& buff, string message);
-  std::string GetFileType();
+  void SetStateLine(ChainBuffer& buff);
+  void SetHeader(ChainBuffer& buff);
+  void SetContent(ChainBuffer& buff);
+  void SetErrorContent(ChainBuffer& buff, string message);
+  void SelectEncoding();
+  void AppendCachedHeader(ChainBuffer& buff);
+  int HeaderSlot() const;
+  bool IsNotModified() const;
+  bool MatchIfRange() const;
+  int ParseRange(off_t size, off_t* begin, off_t* end) const;
+  bool MakeRangeResponse(ChainBuffer& buff);
+  void AddPart(ChainBuffer& buff, off_t offset, size_t len);
+  static bool MatchEtag(StrSlice list, const std::string& etag);
+  const std::string& GetFileType();
+  static bool IsCompressible(const std::string& type);
 
  private:
   int code_;
   bool keep_alive_;
+  bool head_only_;
 
   std::string path_;
   std::string resources_dir_;
 
-  char* mmap_ptr;
+  // 文件缓存中的文件，持有引用直到响应发送完
+  FileCache::FilePtr file_;
+  // sendfile模式下发送文件描述符，否则发送映射的内存
+  bool use_sendfile_;
   struct stat file_stat_;
+  // 客户端可接受的编码和实际发送的编码，编码时file_为压缩后的版本
+  int accept_encoding_;
+  Compressor::ENCODING encoding_;
+  StrSlice if_none_match_;
+  StrSlice if_modified_since_;
+  StrSlice range_;
+  StrSlice if_range_;
+  // 多个范围时以multipart/byteranges发送
+  bool multipart_;
+  string boundary_;
+  Part parts_[kMaxRanges];
+  int n_parts_;
 
   static const std::unordered_map<std::string, std::string> kSuffixToType;
   static const std::unordered_map<int, std::string> kCodeToStatus;
@@ -6,16 +6,25 @@
 #ifndef BLOCKQUEUE_H
 #define BLOCKQUEUE_H
 
+#include <assert.h>
 #include <sys/time.h>
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <mutex>
+#include <thread>
+#include <utility>
 
+/* 有界阻塞队列
+只在确实有线程在等待时才notify；消费者可以先自旋spin轮再睡眠，
+可以用drain一次取走多个元素，只加锁、唤醒生产者一次；元素尽量移动而不是复制
+*/
 template <class T>
 class BlockDeque {
  public:
-  explicit BlockDeque(size_t MaxCapacity = 1000);
+  explicit BlockDeque(size_t MaxCapacity = 1000, int spin = 0);
 
   ~BlockDeque();
 
@@ -37,15 +46,30 @@ class BlockDeque {
 
   void push_back(const T &item);
 
+  void push_back(T &&item);
+
   void push_front(const T &item);
 
+  void push_front(T &&item);
+
   bool pop(T &item);
 
   bool pop(T &item, int timeout);
 
+  /* 阻塞到至少有一个元素，最多取出max个追加到out，返回取出的个数；关闭时返回0 */
+  template <class Container>
+  size_t drain(Container &out, size_t max = static_cast<size_t>(-1));
+
   void flush();
 
  private:
+  template <class U>
+  void Push(U &&item, bool front);
+
+  T Take();
+
+  void Spin();
+
   std::deque<T> deq_;
 
   size_t capacity_;
@@ -54,15 +78,28 @@ class BlockDeque {
 
   bool isClose_;
 
+  // 等待的消费者和生产者数，为0时不需要notify
+  int consumerWaiting_;
+
+  int producerWaiting_;
+
+  // 消费者睡眠前自旋的轮数，自旋时不加锁地查看队列长度
+  const int spin_;
+
+  std::atomic<size_t> size_;
+
   std::condition_variable condConsumer_;
 
   std::condition_variable condProducer_;
 };
 
 template <class T>
-BlockDeque<T>::BlockDeque(size_t MaxCapacity) : capacity_(MaxCapacity) {
+BlockDeque<T>::BlockDeque(size_t MaxCapacity, int spin)
+    : capacity_(MaxCapacity), spin_(spin), size_(0) {
   assert(MaxCapacity > 0);
   isClose_ = false;
+  consumerWaiting_ = 0;
+  producerWaiting_ = 0;
 }
 
 template <class T>
@@ -75,6 +112,7 @@ void BlockDeque<T>::Close() {
   {
     std::lock_guard<std::mutex> locker(mtx_);
     deq_.clear();
+    size_.store(0, std::memory_order_relaxed);
     isClose_ = true;
   }
   condProducer_.notify_all();
@@ -88,8 +126,15 @@ void BlockDeque<T>::flush() {
 
 template <class T>
 void BlockDeque<T>::clear() {
-  std::lock_guard<std::mutex> locker(mtx_);
-  deq_.clear();
+  {
+    std::lock_guard<std::mutex> locker(mtx_);
+    deq_.clear();
+    size_.store(0, std::memory_order_relaxed);
+    if (producerWaiting_ == 0) {
+      return;
+    }
+  }
+  condProducer_.notify_all();
 }
 
 template <class T>
@@ -117,23 +162,44 @@ size_t BlockDeque<T>::capacity() {
 }
 
 template <class T>
-void BlockDeque<T>::push_back(const T &item) {
+template <class U>
+void BlockDeque<T>::Push(U &&item, bool front) {
   std::unique_lock<std::mutex> locker(mtx_);
   while (deq_.size() >= capacity_) {
+    producerWaiting_++;
     condProducer_.wait(locker);
+    producerWaiting_--;
   }
-  deq_.push_back(item);
-  condConsumer_.notify_one();
+  if (front) {
+    deq_.push_front(std::forward<U>(item));
+  } else {
+    deq_.push_back(std::forward<U>(item));
+  }
+  size_.store(deq_.size(), std::memory_order_relaxed);
+  if (consumerWaiting_ > 0) {
+    locker.unlock();
+    condConsumer_.notify_one();
+  }
+}
+
+template <class T>
+void BlockDeque<T>::push_back(const T &item) {
+  Push(item, false);
+}
+
+template <class T>
+void BlockDeque<T>::push_back(T &&item) {
+  Push(std::move(item), false);
 }
 
 template <class T>
 void BlockDeque<T>::push_front(const T &item) {
-  std::unique_lock<std::mutex> locker(mtx_);
-  while (deq_.size() >= capacity_) {
-    condProducer_.wait(locker);
-  }
-  deq_.push_front(item);
-  condConsumer_.notify_one();
+  Push(item, true);
+}
+
+template <class T>
+void BlockDeque<T>::push_front(T &&item) {
+  Push(std::move(item), true);
 }
 
 template <class T>
@@ -148,37 +214,92 @@ bool BlockDeque<T>::full() {
   return deq_.size() >= capacity_;
 }
 
+/* 自旋等待队列非空，最多spin_轮 */
+template <class T>
+void BlockDeque<T>::Spin() {
+  for (int i = 0; i < spin_ && size_.load(std::memory_order_relaxed) == 0;
+       i++) {
+    std::this_thread::yield();
+  }
+}
+
+/* 持有锁时取出队头，移动而不是复制 */
+template <class T>
+T BlockDeque<T>::Take() {
+  T item = std::move(deq_.front());
+  deq_.pop_front();
+  size_.store(deq_.size(), std::memory_order_relaxed);
+  return item;
+}
+
 template <class T>
 bool BlockDeque<T>::pop(T &item) {
+  Spin();
   std::unique_lock<std::mutex> locker(mtx_);
   while (deq_.empty()) {
-    condConsumer_.wait(locker);
     if (isClose_) {
       return false;
     }
+    consumerWaiting_++;
+    condConsumer_.wait(locker);
+    consumerWaiting_--;
+  }
+  item = Take();
+  if (producerWaiting_ > 0) {
+    locker.unlock();
+    condProducer_.notify_one();
   }
-  item = deq_.front();
-  deq_.pop_front();
-  condProducer_.notify_one();
   return true;
 }
 
 template <class T>
 bool BlockDeque<T>::pop(T &item, int timeout) {
+  Spin();
   std::unique_lock<std::mutex> locker(mtx_);
   while (deq_.empty()) {
-    if (condConsumer_.wait_for(locker, std::chrono::seconds(timeout)) ==
-        std::cv_status::timeout) {
+    if (isClose_) {
       return false;
     }
-    if (isClose_) {
+    consumerWaiting_++;
+    std::cv_status status =
+        condConsumer_.wait_for(locker, std::chrono::seconds(timeout));
+    consumerWaiting_--;
+    if (status == std::cv_status::timeout) {
       return false;
     }
   }
-  item = deq_.front();
-  deq_.pop_front();
-  condProducer_.notify_one();
+  item = Take();
+  if (producerWaiting_ > 0) {
+    locker.unlock();
+    condProducer_.notify_one();
+  }
   return true;
 }
 
-#endif  // BLOCKQUEUE_H
\ No newline at end of file
+template <class T>
+template <class Container>
+size_t BlockDeque<T>::drain(Container &out, size_t max) {
+  Spin();
+  std::unique_lock<std::mutex> locker(mtx_);
+  while (deq_.empty()) {
+    if (isClose_) {
+      return 0;
+    }
+    consumerWaiting_++;
+    condConsumer_.wait(locker);
+    consumerWaiting_--;
+  }
+  size_t n = 0;
+  while (n < max && !deq_.empty()) {
+    out.push_back(Take());
+    n++;
+  }
+  // 一次空出多个位置，唤醒所有等待的生产者
+  if (producerWaiting_ > 0) {
+    locker.unlock();
+    condProducer_.notify_all();
+  }
+  return n;
+}
+
+#endif  // BLOCKQUEUE_H
@@ -0,0 +1,267 @@
+#include "logformat.h"
+
+#include <stdio.h>
+
+#include <string>
+
+namespace {
+/* 按转换说明格式化一个参数，n_star个*的值在stars中 */
+template <typename T>
+int Print(char* out, int size, const char* spec, int n_star, const int* stars,
+          T value) {
+  if (size <= 0) {
+    return 0;
+  }
+  int n;
+  switch (n_star) {
+    case 0:
+      n = snprintf(out, size, spec, value);
+      break;
+    case 1:
+      n = snprintf(out, size, spec, stars[0], value);
+      break;
+    default:
+      n = snprintf(out, size, spec, stars[0], stars[1], value);
+      break;
+  }
+  if (n < 0) {
+    return 0;
+  }
+  return n < size ? n : size - 1;
+}
+
+/* 复制格式串中两个转换之间的文字，%%还原为% */
+int CopyText(char* out, int size, const char* text, size_t len) {
+  int n = 0;
+  for (size_t i = 0; i < len && n < size - 1; i++) {
+    if (text[i] == '%' && i + 1 < len && text[i + 1] == '%') {
+      i++;
+    }
+    out[n++] = text[i];
+  }
+  if (size > 0) {
+    out[n] = '\0';
+  }
+  return n;
+}
+}  // namespace
+
+LogFormat::LogFormat(int level, const char* format)
+    : level_(level), format_(format), valid_(true), n_args_(0), n_specs_(0) {
+  Parse();
+}
+
+/* 解析格式串：%[标志][宽度][.精度][长度]转换 */
+void LogFormat::Parse() {
+  const char* p = format_;
+  while ((p = strchr(p, '%')) != nullptr) {
+    const char* begin = p++;
+    if (*p == '%') {
+      p++;
+      continue;
+    }
+    if (n_specs_ == kMaxArgs) {
+      valid_ = false;
+      return;
+    }
+    Spec& spec = specs_[n_specs_];
+    spec.begin = begin - format_;
+    spec.n_star = 0;
+    while (*p && strchr("-+ #0'", *p)) {
+      p++;
+    }
+    if (*p == '*') {
+      if (!AddArg(INT, -1)) {
+        return;
+      }
+      spec.n_star++;
+      p++;
+    } else {
+      while (*p >= '0' && *p <= '9') {
+        p++;
+      }
+    }
+    int precision = -1;
+    if (*p == '.') {
+      p++;
+      if (*p == '*') {
+        if (!AddArg(INT, -1)) {
+          return;
+        }
+        spec.n_star++;
+        precision = -2;
+        p++;
+      } else {
+        precision = 0;
+        while (*p >= '0' && *p <= '9') {
+          precision = precision * 10 + (*p++ - '0');
+        }
+      }
+    }
+    const char* modifier = p;
+    while (*p && strchr("hlLqjzt", *p)) {
+      p++;
+    }
+    const char* length = "";
+    switch (*p) {
+      case 'd':
+      case 'i':
+        spec.kind = INT;
+        length = "ll";
+        break;
+      case 'c':
+        spec.kind = INT;
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        spec.kind = UINT;
+        length = "ll";
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        spec.kind = DOUBLE;
+        break;
+      case 's':
+        spec.kind = STRING;
+        break;
+      case 'p':
+        spec.kind = POINTER;
+        break;
+      default:
+        // %n、宽字符等不支持的转换，这个调用点总是直接格式化
+        valid_ = false;
+        return;
+    }
+    if (!AddArg(spec.kind, spec.kind == STRING ? precision : -1)) {
+      return;
+    }
+    int n = snprintf(spec.spec, kMaxSpecLength, "%.*s%s%c",
+                     static_cast<int>(modifier - begin), begin, length, *p++);
+    if (n >= kMaxSpecLength) {
+      valid_ = false;
+      return;
+    }
+    spec.end = p - format_;
+    n_specs_++;
+  }
+}
+
+bool LogFormat::AddArg(ARG_KIND kind, int precision) {
+  if (n_args_ == kMaxArgs) {
+    valid_ = false;
+    return false;
+  }
+  args_[n_args_].kind = kind;
+  args_[n_args_].precision = precision;
+  n_args_++;
+  return true;
+}
+
+/* 字符串复制内容，先存长度；精度由参数给出时取前一个整数参数 */
+void LogFormat::Encoder::PutString(const char* str, int precision) {
+  if (!str) {
+    str = "(null)";
+  }
+  if (precision == -2) {
+    precision = last_int_ < 0 || last_int_ > INT32_MAX
+                    ? -1
+                    : static_cast<int>(last_int_);
+  }
+  size_t len = precision >= 0 ? strnlen(str, precision) : strlen(str);
+  size_t room = end_ - pos_;
+  if (room < sizeof(uint32_t)) {
+    ok_ = false;
+    return;
+  }
+  room -= sizeof(uint32_t);
+  if (len > room) {
+    len = room;
+  }
+  uint32_t n = static_cast<uint32_t>(len);
+  memcpy(pos_, &n, sizeof(n));
+  memcpy(pos_ + sizeof(n), str, len);
+  pos_ += sizeof(n) + len;
+}
+
+int LogFormat::Decode(const char* data, size_t len, char* out,
+                      int size) const {
+  const char* end = data + len;
+  int n = 0;
+  size_t pos = 0;
+  for (int k = 0; k < n_specs_; k++) {
+    const Spec& spec = specs_[k];
+    n += CopyText(out + n, size - n, format_ + pos, spec.begin - pos);
+    pos = spec.end;
+
+    int stars[2] = {0, 0};
+    for (int i = 0; i < spec.n_star; i++) {
+      long long v;
+      if (end - data < static_cast<ptrdiff_t>(sizeof(v))) {
+        return n;
+      }
+      memcpy(&v, data, sizeof(v));
+      data += sizeof(v);
+      stars[i] = static_cast<int>(v);
+    }
+
+    const char* fmt = spec.spec;
+    if (spec.kind == STRING) {
+      uint32_t str_len;
+      if (end - data < static_cast<ptrdiff_t>(sizeof(str_len))) {
+        return n;
+      }
+      memcpy(&str_len, data, sizeof(str_len));
+      data += sizeof(str_len);
+      if (static_cast<size_t>(end - data) < str_len) {
+        return n;
+      }
+      // 编码时没有存结尾的'\0'
+      std::string str(data, str_len);
+      data += str_len;
+      n += Print(out + n, size - n, fmt, spec.n_star, stars, str.c_str());
+      continue;
+    }
+
+    uint64_t raw;
+    if (end - data < static_cast<ptrdiff_t>(sizeof(raw))) {
+      return n;
+    }
+    memcpy(&raw, data, sizeof(raw));
+    data += sizeof(raw);
+    switch (spec.kind) {
+      case INT:
+        if (fmt[strlen(fmt) - 1] == 'c') {
+          n += Print(out + n, size - n, fmt, spec.n_star, stars,
+                     static_cast<int>(raw));
+        } else {
+          n += Print(out + n, size - n, fmt, spec.n_star, stars,
+                     static_cast<long long>(raw));
+        }
+        break;
+      case UINT:
+        n += Print(out + n, size - n, fmt, spec.n_star, stars,
+                   static_cast<unsigned long long>(raw));
+        break;
+      case DOUBLE: {
+        double v;
+        memcpy(&v, &raw, sizeof(v));
+        n += Print(out + n, size - n, fmt, spec.n_star, stars, v);
+        break;
+      }
+      default:
+        n += Print(out + n, size - n, fmt, spec.n_star, stars,
+                   reinterpret_cast<void*>(static_cast<uintptr_t>(raw)));
+        break;
+    }
+  }
+  n += CopyText(out + n, size - n, format_ + pos, strlen(format_ + pos));
+  return n;
+}
@@ -0,0 +1,146 @@
+#ifndef LOGFORMAT_H
+#define LOGFORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+/* 一个日志调用点的格式串，每个调用点一个静态对象，第一次执行时解析一次
+异步日志只把参数的原始字节按格式串编码，格式化推迟到写线程用Decode完成；
+支持printf的常用转换，遇到不支持的转换(如%n)或参数类型对不上时编码失败，
+调用方退回直接格式化；
+只用定长数组，析构什么也不做，退出时写线程还在格式化的记录仍然可以引用它
+*/
+class LogFormat {
+ public:
+  enum ARG_KIND { INT = 0, UINT, DOUBLE, STRING, POINTER };
+  static const int kMaxArgs = 16;
+  static const int kMaxSpecLength = 24;
+
+  LogFormat(int level, const char* format);
+
+  inline int GetLevel() const { return level_; }
+  inline const char* GetFormat() const { return format_; }
+
+  /* 把参数编码到buf，返回编码后的长度，失败返回-1；字符串放不下时截断 */
+  template <typename... Args>
+  int Encode(char* buf, size_t size, Args... args) const {
+    if (!valid_ || sizeof...(Args) != static_cast<size_t>(n_args_)) {
+      return -1;
+    }
+    Encoder encoder(*this, buf, buf + size);
+    int expand[] = {0, (encoder.Put(args), 0)...};
+    (void)expand;
+    return encoder.Finish();
+  }
+
+  /* 按格式串把编码的参数格式化到out，返回写入的长度，超长的截断 */
+  int Decode(const char* data, size_t len, char* out, int size) const;
+
+ private:
+  struct Arg {
+    ARG_KIND kind;
+    int precision;  // 字符串的精度，-1表示没有，-2表示由前一个参数给出
+  };
+  /* 一个转换说明，长度修饰符换成和编码类型一致的ll */
+  struct Spec {
+    size_t begin;  // 在格式串中的位置
+    size_t end;
+    int n_star;  // 宽度和精度中*的个数，各占一个参数
+    ARG_KIND kind;
+    char spec[kMaxSpecLength];
+  };
+
+  class Encoder {
+   public:
+    Encoder(const LogFormat& format, char* begin, char* end)
+        : format_(format), pos_(begin), begin_(begin), end_(end), arg_(0),
+          last_int_(-1), ok_(true) {}
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value ||
+                            std::is_enum<T>::value>::type
+    Put(T value) {
+      switch (NextKind()) {
+        case INT:
+          last_int_ = static_cast<long long>(value);
+          PutRaw(&last_int_, sizeof(last_int_));
+          break;
+        case UINT: {
+          unsigned long long v = static_cast<unsigned long long>(value);
+          PutRaw(&v, sizeof(v));
+          break;
+        }
+        case DOUBLE: {
+          double v = static_cast<double>(value);
+          PutRaw(&v, sizeof(v));
+          break;
+        }
+        default:
+          ok_ = false;
+      }
+    }
+
+    void Put(const char* str) {
+      if (arg_ < format_.n_args_ && format_.args_[arg_].kind == STRING) {
+        PutString(str, format_.args_[arg_].precision);
+        arg_++;
+      } else {
+        Put(static_cast<const void*>(str));
+      }
+    }
+    void Put(char* str) { Put(static_cast<const char*>(str)); }
+
+    template <typename T>
+    void Put(T* ptr) {
+      if (NextKind() != POINTER) {
+        ok_ = false;
+        return;
+      }
+      uint64_t v = reinterpret_cast<uintptr_t>(ptr);
+      PutRaw(&v, sizeof(v));
+    }
+
+    int Finish() const {
+      return ok_ ? static_cast<int>(pos_ - begin_) : -1;
+    }
+
+   private:
+    inline ARG_KIND NextKind() {
+      return arg_ < format_.n_args_ ? format_.args_[arg_++].kind
+                                    : static_cast<ARG_KIND>(-1);
+    }
+    inline void PutRaw(const void* data, size_t len) {
+      if (static_cast<size_t>(end_ - pos_) < len) {
+        ok_ = false;
+        return;
+      }
+      memcpy(pos_, data, len);
+      pos_ += len;
+    }
+    void PutString(const char* str, int precision);
+
+    const LogFormat& format_;
+    char* pos_;
+    char* begin_;
+    char* end_;
+    int arg_;
+    long long last_int_;  // 最近一个整数参数，可能是下一个字符串的精度
+    bool ok_;
+  };
+
+  void Parse();
+  bool AddArg(ARG_KIND kind, int precision);
+
+  int level_;
+  const char* format_;
+  bool valid_;
+  int n_args_;
+  int n_specs_;
+  Arg args_[kMaxArgs];
+  Spec specs_[kMaxArgs];
+};
+
+#endif
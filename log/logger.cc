@@ -1,174 +1,390 @@
 #include "logger.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
 using namespace std;
 
+namespace {
+/* 每个线程的环形队列，线程退出时标记关闭，由写线程取完数据后释放 */
+struct RingHolder {
+  RingHolder() : ring(nullptr) {}
+  ~RingHolder() {
+    if (ring) {
+      ring->Close();
+    }
+  }
+  LogRing *ring;
+};
+thread_local RingHolder ring_holder;
+
+const char* const kLevelTitles[] = {"[debug]: ", "[info] : ", "[warn] : ",
+                                    "[error]: "};
+const int kLevelTitleLength = 9;
+}  // namespace
+
+const int Log::kFlushIntervalMs;
+const int Log::kPollIntervalMs;
+
 Log::Log() {
-  line_count_ = 0;
+  year_ = 0;
+  month_ = 0;
+  today_ = 0;
+  page_ = 0;
+  fd_ = -1;
+  file_size_ = 0;
+  preallocate_ = false;
   async_ = false;
   writer_ = nullptr;
-  queue_ = nullptr;
-  today_ = 0;
-  fp_ = nullptr;
+  out_len_ = 0;
+  cached_sec_ = -1;
+  cached_time_len_ = 0;
+  wake_pending_ = false;
+  closed_ = false;
+  opened_ = false;
+}
+
+/* 停止写线程，写出所有队列中剩余的日志 */
+Log::~Log() {
+  if (writer_) {
+    closed_.store(true);
+    Wake();
+    writer_->join();
+  }
+  for (LogRing *ring : rings_) {
+    delete ring;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
 }
 
 void Log::write(int level, const char *format, ...) {
-  // 获取当前时间
+  va_list vaList;
+  if (async_ && !closed_.load(memory_order_relaxed)) {
+    // 只格式化内容，时间和级别由写线程补上
+    char record[kMaxLineLength];
+    int room = kMaxLineLength - sizeof(LogRecord);
+    va_start(vaList, format);
+    int m = vsnprintf(record + sizeof(LogRecord), room, format, vaList);
+    va_end(vaList);
+    if (m < 0) {
+      m = 0;
+    }
+    PushRecord(record, sizeof(LogRecord) + (m < room ? m : room - 1), level,
+               nullptr);
+    return;
+  }
+
   struct timeval now = {0, 0};
   gettimeofday(&now, nullptr);
-  time_t tm_sec = now.tv_sec;
-  struct tm *sys_time = localtime(&tm_sec);
-  char tail[36];
-  fill_n(tail, 36, '\0');
-  // 时间不是今天或者已经写完一页
-  // 写入当前时间 yy_mm_dd
-  if (today_ != sys_time->tm_mday || line_count_ % kMaxLines) {
-    unique_lock<mutex> locker(mutex_);
-    locker.unlock();
-
-    snprintf(tail, 36, "%04d_%02d_%02d", sys_time->tm_year + 1900,
-             sys_time->tm_mon + 1, sys_time->tm_mday);
+  char line[kMaxLineLength];
+  lock_guard<mutex> locker(mutex_);
+  UpdateTimeCache(now.tv_sec);
+  int n = FormatPrefix(line, now.tv_usec, level);
+  // 留出换行符和vsnprintf结尾的'\0'
+  int room = kMaxLineLength - n - 1;
+  va_start(vaList, format);
+  int m = vsnprintf(line + n, room, format, vaList);
+  va_end(vaList);
+  if (m > 0) {
+    n += m < room ? m : room - 1;
+  }
+  line[n++] = '\n';
+  WriteFile(line, n);
+}
 
-    char filename[kLogNameLength];
-    fill_n(tail, kLogNameLength, '\0');
-    // 时间不是今天
-    if (today_ != sys_time->tm_mday) {
-      snprintf(filename, kLogNameLength - 72, "%s/%s%s", path_, tail, suffix_);
-      // 更新时间
-      today_ = sys_time->tm_mday;
-      line_count_ = 0;
-    } else {  // 新写一页
-      snprintf(filename, kLogNameLength - 72, "%s/%s-%d%s", path_, tail,
-               (line_count_ / kMaxLines), suffix_);
+/* 秒数变化时才重新计算日期和时间，日期变化时换文件 */
+void Log::UpdateTimeCache(time_t sec) {
+  if (sec == cached_sec_) {
+    return;
+  }
+  cached_sec_ = sec;
+  localtime_r(&sec, &cached_tm_);
+  cached_time_len_ = snprintf(
+      cached_time_, sizeof(cached_time_), "%d-%02d-%02d %02d:%02d:%02d.",
+      cached_tm_.tm_year + 1900, cached_tm_.tm_mon + 1, cached_tm_.tm_mday,
+      cached_tm_.tm_hour, cached_tm_.tm_min, cached_tm_.tm_sec);
+  if (cached_tm_.tm_mday != today_) {
+    Rotate();
+  }
+}
+
+/* 日志行的开头：缓存的时间、微秒、级别 */
+int Log::FormatPrefix(char *line, long usec, int level) {
+  memcpy(line, cached_time_, cached_time_len_);
+  int n = cached_time_len_;
+  for (int i = 5; i >= 0; i--) {
+    line[n + i] = static_cast<char>('0' + usec % 10);
+    usec /= 10;
+  }
+  n += 6;
+  line[n++] = ' ';
+
+  // 写入日志类型
+  if (level < 0 || level > 3) {
+    level = 1;
+  }
+  memcpy(line + n, kLevelTitles[level], kLevelTitleLength);
+  return n + kLevelTitleLength;
+}
+
+/* 补上记录头放入当前线程的环形队列，队列满时唤醒写线程，等它取走数据 */
+void Log::PushRecord(char *record, size_t len, int level,
+                     const LogFormat *format) {
+  LogRecord header;
+  header.size = static_cast<uint32_t>(len);
+  header.level = level;
+  header.format = format;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  header.timestamp = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  memcpy(record, &header, sizeof(header));
+
+  LogRing *ring = GetRing();
+  while (!ring->Push(record, len)) {
+    if (closed_.load()) {
+      return;
     }
-    locker.lock();
-    // 更新文件，互斥访问
-    fclose(fp_);
-    fp_ = fopen(filename, "a");
-    assert(fp_ != nullptr);
+    Wake();
+    this_thread::yield();
+  }
+  if (ring->Size() >= ring->Capacity() / 2) {
+    Wake();
   }
+}
 
-  {
-    unique_lock<mutex> locker(mutex_);  // 互斥访问队列或者文件
-    // 更新行号
-    line_count_++;
-    // 写入详细时间,精确到毫秒
-    int n = snprintf(
-        buffer_.NextWriteable(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-        sys_time->tm_year + 1900, sys_time->tm_mon + 1, sys_time->tm_mday,
-        sys_time->tm_hour, sys_time->tm_min, sys_time->tm_sec, now.tv_usec);
-    // 更新缓冲区偏移量
-    buffer_.MoveWritePos(n);
-
-    // 写入日志类型
-    AppendLogLevelTitle(level);
-
-    va_list vaList;
-    va_start(vaList, format);
-    int m = vsnprintf(buffer_.NextWriteable(), buffer_.GetWritableBytes(), format,
-                      vaList);
-    va_end(vaList);
+/* 当前线程第一次写日志时创建它的环形队列并登记给写线程 */
+LogRing *Log::GetRing() {
+  LogRing *&ring = ring_holder.ring;
+  if (!ring) {
+    ring = new LogRing(kRingSize);
+    lock_guard<mutex> locker(mutex_);
+    rings_.push_back(ring);
+  }
+  return ring;
+}
 
-    buffer_.MoveWritePos(m);
-    buffer_.Append("\n\0", 2);
+/* 只在队列过半、队列已满或主动刷新时调用，平时写线程按间隔自己醒来 */
+void Log::Wake() {
+  if (!wake_pending_.exchange(true)) {
+    // 写线程在wake_mtx_下检查标志，加锁保证不会在检查和睡眠之间丢失通知
+    { lock_guard<mutex> locker(wake_mtx_); }
+    wake_cond_.notify_one();
+  }
+}
+
+/* 换到cached_tm_那天的文件，先把缓冲的旧日志写进旧文件 */
+void Log::Rotate() {
+  FlushOut();
+  year_ = cached_tm_.tm_year + 1900;
+  month_ = cached_tm_.tm_mon + 1;
+  today_ = cached_tm_.tm_mday;
+  page_ = 0;
+  OpenFile();
+}
 
-    if (async_ && queue_ && !queue_->full()) {
-      queue_->push_back(buffer_.RetrieveAllToStr());
+/* 打开当天第page_个文件，已经写满的跳到下一个 */
+void Log::OpenFile() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  while (true) {
+    char filename[kLogNameLength];
+    if (page_ == 0) {
+      snprintf(filename, kLogNameLength, "%s/%04d_%02d_%02d%s", path_, year_,
+               month_, today_, suffix_);
     } else {
-      fputs(buffer_.NextReadable(), fp_);
+      snprintf(filename, kLogNameLength, "%s/%04d_%02d_%02d-%d%s", path_,
+               year_, month_, today_, page_, suffix_);
+    }
+    fd_ = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    assert(fd_ >= 0);
+    struct stat st;
+    file_size_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    if (file_size_ < kMaxFileSize) {
+      break;
     }
-    buffer_.Reset();
-    // 离开作用域自动解锁
+    close(fd_);
+    page_++;
+  }
+  // 预留文件的空间但不改变文件大小，追加写时不必再分配块
+  if (preallocate_) {
+    fallocate(fd_, FALLOC_FL_KEEP_SIZE, file_size_, kMaxFileSize - file_size_);
   }
 }
 
-void Log::AppendLogLevelTitle(int level) {
-  switch (level) {
-    case 0:
-      buffer_.Append("[debug]: ", 9);
-      break;
-    case 1:
-      buffer_.Append("[info] : ", 9);
-      break;
-    case 2:
-      buffer_.Append("[warn] : ", 9);
-      break;
-    case 3:
-      buffer_.Append("[error]: ", 9);
-      break;
-    default:
-      buffer_.Append("[info] : ", 9);
+/* 写线程把攒的一批日志用一次write写出 */
+void Log::FlushOut() {
+  if (out_len_ > 0) {
+    WriteFile(out_.get(), out_len_);
+    out_len_ = 0;
+  }
+}
+
+/* 写满kMaxFileSize后换下一个文件 */
+void Log::WriteFile(const char *data, size_t len) {
+  if (file_size_ > 0 && file_size_ + len > kMaxFileSize) {
+    page_++;
+    OpenFile();
+  }
+  while (len > 0) {
+    ssize_t n = ::write(fd_, data, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
       break;
+    }
+    data += n;
+    len -= n;
+    file_size_ += n;
   }
 }
 
+/* queue_max_size大于0时使用异步写线程 */
 void Log::Init(int level = 1, const char *path, const char *suffix,
-               int queue_max_size) {
+               int queue_max_size, bool preallocate) {
   opened_ = true;
   level_ = level;
+  path_ = path;
+  suffix_ = suffix;
+
+  {
+    lock_guard<mutex> locker(mutex_);
+    mkdir(path_, 0777);
+    preallocate_ = preallocate;
+    today_ = 0;
+    cached_sec_ = -1;
+    UpdateTimeCache(time(nullptr));
+  }
+
   if (queue_max_size > 0) {
     async_ = true;
-    if (!queue_) {
-      unique_ptr<BlockDeque<std::string>> q(new BlockDeque<std::string>);
-      queue_ = move(q);
-      std::unique_ptr<std::thread> t(
+    if (!writer_) {
+      scratch_.reset(new char[kRingSize]);
+      out_.reset(new char[kFlushBytes]);
+      std::unique_ptr<std::thread> writer(
           new std::thread([] { Log::Instance()->AsyncWrite(); }));
-      writer_ = move(t);
+      writer_ = move(writer);
     }
   } else {
     async_ = false;
   }
+}
 
-  line_count_ = 0;
+Log *Log::Instance() {
+  static Log instance;
+  return &instance;
+}
 
-  time_t timer = time(nullptr);
-  struct tm *sysTime = localtime(&timer);
-  struct tm t = *sysTime;
-  path_ = path;
-  suffix_ = suffix;
-  char fileName[kLogNameLength] = {0};
-  snprintf(fileName, kLogNameLength - 1, "%s/%04d_%02d_%02d%s", path_,
-           t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-  today_ = t.tm_mday;
+/* 取走所有环形队列中的记录，格式化到写线程的缓冲区 */
+void Log::Drain() {
+  // 记录中是单调时钟，加上与墙上时钟的差换算成当前时间
+  struct timespec real, mono;
+  clock_gettime(CLOCK_REALTIME, &real);
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  int64_t clock_offset = (real.tv_sec - mono.tv_sec) * 1000000000LL +
+                         (real.tv_nsec - mono.tv_nsec);
 
-  {
-    lock_guard<mutex> locker(mutex_);
-    buffer_.Reset();
-    if (fp_) {
-      flush();
-      fclose(fp_);
+  lock_guard<mutex> locker(mutex_);
+  for (auto it = rings_.begin(); it != rings_.end();) {
+    LogRing *ring = *it;
+    // 先看是否关闭再取数据，关闭前写入的数据一定能取到
+    bool closed = ring->IsClosed();
+    struct iovec iov[2];
+    int n = ring->Peek(iov);
+    if (n > 0) {
+      const char *data = static_cast<const char *>(iov[0].iov_base);
+      size_t len = iov[0].iov_len;
+      // 环绕的记录拼接到一起再解析
+      if (n == 2) {
+        memcpy(scratch_.get(), iov[0].iov_base, iov[0].iov_len);
+        memcpy(scratch_.get() + len, iov[1].iov_base, iov[1].iov_len);
+        data = scratch_.get();
+        len += iov[1].iov_len;
+      }
+      for (size_t pos = 0; pos < len;) {
+        uint32_t size;
+        memcpy(&size, data + pos, sizeof(size));
+        DecodeRecord(data + pos, size, clock_offset);
+        pos += size;
+      }
+      ring->Consume(len);
     }
-
-    fp_ = fopen(fileName, "a");
-    if (fp_ == nullptr) {
-      mkdir(path_, 0777);
-      fp_ = fopen(fileName, "a");
+    if (closed) {
+      delete ring;
+      it = rings_.erase(it);
+    } else {
+      ++it;
     }
-    assert(fp_ != nullptr);
   }
 }
 
-Log *Log::Instance() {
-  static Log instance;
-  return &instance;
+/* 把一条记录格式化到缓冲区末尾，放不下一整行时先写出 */
+void Log::DecodeRecord(const char *data, size_t len, int64_t clock_offset) {
+  LogRecord header;
+  memcpy(&header, data, sizeof(header));
+  const char *payload = data + sizeof(header);
+  size_t payload_len = len - sizeof(header);
+
+  int64_t now = header.timestamp + clock_offset;
+  UpdateTimeCache(now / 1000000000);
+  if (kFlushBytes - out_len_ < static_cast<size_t>(kMaxLineLength)) {
+    FlushOut();
+  }
+  char *line = out_.get() + out_len_;
+  int n = FormatPrefix(line, now % 1000000000 / 1000, header.level);
+  int room = kMaxLineLength - n - 1;
+  if (header.format) {
+    n += header.format->Decode(payload, payload_len, line + n, room);
+  } else {
+    size_t m = min(payload_len, static_cast<size_t>(room - 1));
+    memcpy(line + n, payload, m);
+    n += m;
+  }
+  line[n++] = '\n';
+  out_len_ += n;
 }
 
+/* 写线程：每隔kPollIntervalMs或被唤醒时取一批记录，
+缓冲区满、超过kFlushIntervalMs或被主动唤醒时写出
+*/
 void Log::AsyncWrite() {
-  string str = "";
-  while (queue_->pop(str)) {
-    lock_guard<mutex> locker(mutex_);
-    fputs(str.c_str(), fp_);
+  bool woken = false;
+  auto last_flush = chrono::steady_clock::now();
+  while (true) {
+    bool closed = closed_.load();
+    Drain();
+    auto now = chrono::steady_clock::now();
+    if (woken || closed ||
+        now - last_flush >= chrono::milliseconds(kFlushIntervalMs)) {
+      lock_guard<mutex> locker(mutex_);
+      FlushOut();
+      last_flush = now;
+    }
+    if (closed) {
+      break;
+    }
+    unique_lock<mutex> locker(wake_mtx_);
+    wake_cond_.wait_for(locker, chrono::milliseconds(kPollIntervalMs),
+                        [this] { return wake_pending_.load(); });
+    woken = wake_pending_.exchange(false);
   }
 }
 
+/* 异步模式唤醒写线程尽快写出，同步模式每行都直接写入文件 */
 void Log::flush() {
   if (async_) {
-    queue_->flush();
+    Wake();
   }
-  fflush(fp_);
 }
 
 int main_logger() {
   Log log;
   log.write(0, "test");
   return 0;
-}
\ No newline at end of file
+}
@@ -5,24 +5,66 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
-#include "../utils/buffer.h"
-#include "blockqueue.h"
+#include "logformat.h"
+#include "logring.h"
 
 using std::string;
 
+/* 编译时的最低日志级别，低于它的LOG_*调用不生成任何代码，
+例如编译时加上-DLOG_MIN_LEVEL=1去掉所有LOG_DEBUG
+*/
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+/* 环形队列中一条日志记录的头，后面跟着编码的参数或格式化好的文字 */
+struct LogRecord {
+  uint32_t size;  // 包括记录头
+  int32_t level;
+  const LogFormat* format;  // 为空时后面是已经格式化好的文字
+  int64_t timestamp;        // CLOCK_MONOTONIC，纳秒
+};
+
+/* 日志
+异步模式下调用线程只记录调用点的格式、单调时钟时间和参数的原始字节，
+写入自己的无锁环形队列，不加锁也不格式化；
+后台写线程定时或在某个队列超过一半时被唤醒，一次取走所有队列中的记录，
+格式化到自己的缓冲区，攒满或超过时间间隔后用一次write写出；
+时间前缀按秒缓存，日期变化或文件写满kMaxFileSize时换文件，都在写线程中完成；
+同步模式下直接格式化，加锁写文件
+*/
 class Log {
  public:
   Log();
+  ~Log();
   void write(int level, const char* format, ...);
+  /* LOG_*使用：异步模式下只编码参数，格式化推迟到写线程 */
+  template <typename... Args>
+  void Write(const LogFormat& format, Args... args) {
+    if (async_ && !closed_.load(std::memory_order_relaxed)) {
+      char record[kMaxLineLength];
+      int n = format.Encode(record + sizeof(LogRecord),
+                            sizeof(record) - sizeof(LogRecord), args...);
+      if (n >= 0) {
+        PushRecord(record, sizeof(LogRecord) + n, format.GetLevel(), &format);
+        return;
+      }
+    }
+    write(format.GetLevel(), format.GetFormat(), args...);
+  }
   void Init(int level, const char* path = "./log", const char* suffix = ".log",
-            int queue_max_size = 1024);
+            int queue_max_size = 1024, bool preallocate = false);
   static Log* Instance();
   bool IsOpen() { return opened_; }
   inline int GetLevel() { return level_; }
@@ -30,36 +72,69 @@ class Log {
   void flush();
 
  private:
-  int today_;                             // 记录当前天数
-  int line_count_;                        // 当前行数
-  static const int kMaxLines = 10000;     // 最大行数
+  int year_;  // 当前文件的日期
+  int month_;
+  int today_;
+  int page_;                              // 当天的第几个文件
   static const int kLogNameLength = 256;  // 文件名最大长度
   static const int kLogPathLength = 1024;
+  static const int kMaxLineLength = 1024;     // 单行日志的最大长度
+  static const size_t kMaxFileSize = 64 << 20;  // 单个文件的最大字节数
+  static const size_t kRingSize = 64 * 1024;  // 每个线程的环形队列大小
+  static const size_t kFlushBytes = 64 * 1024;  // 写线程缓冲区大小
+  static const int kFlushIntervalMs = 1000;     // 最长刷新间隔
+  static const int kPollIntervalMs = 100;       // 写线程检查队列的间隔
 
   const char* path_;
   const char* suffix_;
-  FILE* fp_;       // 当前写入的文件
-  Buffer buffer_;  // 缓冲区
+  int fd_;  // 当前写入的文件，异步模式下只由写线程访问
+  size_t file_size_;
+  bool preallocate_;  // 新文件用fallocate预留kMaxFileSize的空间
   bool async_;
-  std::unique_ptr<BlockDeque<string>> queue_;
   std::unique_ptr<std::thread> writer_;
 
-  std::mutex mutex_;
+  std::mutex mutex_;  // 同步模式写文件，以及登记环形队列
+  std::vector<LogRing*> rings_;
+  std::unique_ptr<char[]> scratch_;  // 写线程拼接环绕的数据
+  std::unique_ptr<char[]> out_;      // 写线程攒批的缓冲区
+  size_t out_len_;
+  // 时间前缀缓存，同一秒内的日志只复制
+  time_t cached_sec_;
+  struct tm cached_tm_;
+  char cached_time_[32];
+  int cached_time_len_;
+  std::atomic<bool> wake_pending_;
+  std::atomic<bool> closed_;
+  std::mutex wake_mtx_;
+  std::condition_variable wake_cond_;
   bool opened_;
   int level_;
 
  private:
-  void AppendLogLevelTitle(int level);
+  void UpdateTimeCache(time_t sec);
+  int FormatPrefix(char* line, long usec, int level);
+  void PushRecord(char* record, size_t len, int level,
+                  const LogFormat* format);
+  void DecodeRecord(const char* data, size_t len, int64_t clock_offset);
+  LogRing* GetRing();
+  void Wake();
+  void Drain();
+  void Rotate();
+  void OpenFile();
+  void FlushOut();
+  void WriteFile(const char* data, size_t len);
   void AsyncWrite();
 };
 
-#define LOG_BASE(level, format, ...)                 \
-  do {                                               \
-    Log* log = Log::Instance();                      \
-    if (log->IsOpen() && log->GetLevel() <= level) { \
-      log->write(level, format, ##__VA_ARGS__);      \
-      log->flush();                                  \
-    }                                                \
+#define LOG_BASE(level, format, ...)                  \
+  do {                                                \
+    if (level >= LOG_MIN_LEVEL) {                     \
+      Log* log = Log::Instance();                     \
+      if (log->IsOpen() && log->GetLevel() <= level) {\
+        static const LogFormat log_format(level, format);\
+        log->Write(log_format, ##__VA_ARGS__);        \
+      }                                               \
+    }                                                 \
   } while (0);
 
 #define LOG_DEBUG(format, ...)         \
@@ -79,4 +154,4 @@ class Log {
     LOG_BASE(3, format, ##__VA_ARGS__) \
   } while (0);
 
-#endif
\ No newline at end of file
+#endif
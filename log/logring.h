@@ -0,0 +1,90 @@
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include <assert.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+/* 单生产者单消费者的无锁字节环形队列
+每个写日志的线程独占一个，只有后台写线程读取；
+生产者只追加完整的记录，所以消费者任何时候看到的可读数据都以完整记录结束
+*/
+class LogRing {
+ public:
+  explicit LogRing(size_t capacity)
+      : buffer_(new char[capacity]),
+        capacity_(capacity),
+        tail_(0),
+        head_(0),
+        closed_(false) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+  }
+
+  /* 生产者：空间不够时不写入，返回false */
+  bool Push(const char* data, size_t len) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    if (capacity_ - (tail - head) < len) {
+      return false;
+    }
+    size_t offset = tail & (capacity_ - 1);
+    size_t n = std::min(len, capacity_ - offset);
+    memcpy(buffer_.get() + offset, data, n);
+    memcpy(buffer_.get(), data + n, len - n);
+    tail_.store(tail + len, std::memory_order_release);
+    return true;
+  }
+
+  /* 消费者：取出当前所有可读数据，环绕时分成两段，返回段数 */
+  int Peek(struct iovec* iov) const {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t len = tail - head;
+    if (len == 0) {
+      return 0;
+    }
+    size_t offset = head & (capacity_ - 1);
+    size_t n = std::min(len, capacity_ - offset);
+    iov[0].iov_base = buffer_.get() + offset;
+    iov[0].iov_len = n;
+    if (n == len) {
+      return 1;
+    }
+    iov[1].iov_base = buffer_.get();
+    iov[1].iov_len = len - n;
+    return 2;
+  }
+
+  /* 消费者：释放已经写出的数据 */
+  void Consume(size_t len) {
+    head_.store(head_.load(std::memory_order_relaxed) + len,
+                std::memory_order_release);
+  }
+
+  inline size_t Size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+  inline size_t Capacity() const { return capacity_; }
+
+  /* 所属线程退出后标记，写线程取完剩余数据后释放 */
+  inline void Close() { closed_.store(true, std::memory_order_release); }
+  inline bool IsClosed() const {
+    return closed_.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::unique_ptr<char[]> buffer_;
+  const size_t capacity_;
+  // 生产者和消费者的位置分开放在不同的缓存行
+  std::atomic<size_t> tail_;
+  char pad_[64];
+  std::atomic<size_t> head_;
+  std::atomic<bool> closed_;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "connpool.h"
+
+#include <errno.h>
+
+#include "../log/logger.h"
+
+ConnPool::ConnPool(size_t capacity) : slots_(nullptr), capacity_(capacity) {
+  assert(capacity > 0);
+}
+
+ConnPool::~ConnPool() {
+  if (!slots_) {
+    return;
+  }
+  for (size_t i = 0; i < capacity_; i++) {
+    if (slots_[i].constructed) {
+      reinterpret_cast<HttpConnection*>(&slots_[i].storage)->~HttpConnection();
+    }
+  }
+  munmap(slots_, sizeof(Slot) * capacity_);
+}
+
+bool ConnPool::Init() {
+  assert(!slots_);
+  // 匿名映射的内存已清零：generation为0，槽位都未构造
+  void* ptr = mmap(nullptr, sizeof(Slot) * capacity_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    LOG_ERROR("ConnPool mmap error: %d, capacity %zu", errno, capacity_);
+    return false;
+  }
+  slots_ = static_cast<Slot*>(ptr);
+  return true;
+}
+
+uint32_t ConnPool::Acquire(int fd) {
+  Get(fd);
+  return slots_[fd].generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <new>
+#include <type_traits>
+
+#include "../http/connection.h"
+
+/* 按fd直接索引的连接表
+启动时由Init一次性映射capacity个按缓存行对齐的槽位(匿名映射，用到的页才占物理内存)，
+槽位第一次使用时才构造连接对象，之后关闭、复用都只调用Init/Close，不再析构和重新构造。
+每次分配给新连接时槽位的generation加一，随事件一起放进epoll_event.data.u64，
+用来识别fd被关闭又复用之后才处理到的旧事件。
+打开的fd在进程内唯一，多个反应堆可以共享同一张表，各自只访问自己的fd；
+fd关闭后可能立即被另一个反应堆复用，所以HttpConnection::Close最后才关闭fd，
+原反应堆之后只能通过generation判断事件是否过期，generation为原子变量
+*/
+class ConnPool {
+ public:
+  explicit ConnPool(size_t capacity);
+  ~ConnPool();
+
+  /* 映射槽位，失败时返回false */
+  bool Init();
+
+  /* 为新连接占用槽位，返回新的generation */
+  uint32_t Acquire(int fd);
+
+  inline HttpConnection* Get(int fd) {
+    assert(fd >= 0 && static_cast<size_t>(fd) < capacity_);
+    Slot& slot = slots_[fd];
+    if (!slot.constructed) {
+      new (&slot.storage) HttpConnection();
+      slot.constructed = true;
+    }
+    return reinterpret_cast<HttpConnection*>(&slot.storage);
+  }
+
+  inline uint32_t GetGeneration(int fd) const {
+    assert(fd >= 0 && static_cast<size_t>(fd) < capacity_);
+    return slots_[fd].generation.load(std::memory_order_acquire);
+  }
+
+  /* 事件中的generation与槽位一致才是当前连接的事件 */
+  inline bool IsValid(int fd, uint32_t generation) const {
+    return fd >= 0 && static_cast<size_t>(fd) < capacity_ &&
+           slots_[fd].constructed &&
+           slots_[fd].generation.load(std::memory_order_acquire) == generation;
+  }
+
+  inline size_t Capacity() const { return capacity_; }
+
+ private:
+  /* 每个槽位独占整数个缓存行，不同反应堆的连接之间没有伪共享 */
+  struct alignas(64) Slot {
+    std::aligned_storage<sizeof(HttpConnection),
+                         alignof(HttpConnection)>::type storage;
+    std::atomic<uint32_t> generation;  // 匿名映射清零即为0
+    bool constructed;
+  };
+
+  Slot* slots_;
+  size_t capacity_;
+};
+
+#endif
@@ -0,0 +1,385 @@
+#include "sqlconnpool.h"
+
+#include "../log/logger.h"
+
+SqlConnPool::SqlConnPool(Epoller* epoller, HeapTimer* timer)
+    : port_(0), epoller_(epoller), timer_(timer), event_fd_(-1) {
+  assert(epoller_ && timer_);
+}
+
+SqlConnPool::~SqlConnPool() {
+  for (size_t i = 0; i < conns_.size(); i++) {
+    CloseConn(i);
+  }
+  if (event_fd_ >= 0) {
+    epoller_->DelFd(event_fd_);
+    close(event_fd_);
+  }
+}
+
+bool SqlConnPool::Init(const char* host, int port, const char* user,
+                       const char* pwd, const char* db_name, int conn_size) {
+  assert(conn_size > 0);
+  host_ = host;
+  port_ = port;
+  user_ = user;
+  pwd_ = pwd;
+  db_name_ = db_name;
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0 || !epoller_->AddFd(event_fd_, EPOLLIN)) {
+    LOG_ERROR("SqlConnPool eventfd error: %d", errno);
+    return false;
+  }
+  // 回调中按下标找到连接，之后不再改变大小
+  conns_.resize(conn_size);
+  for (size_t i = 0; i < conns_.size(); i++) {
+    Connect(i);
+  }
+  return true;
+}
+
+void SqlConnPool::Query(std::string sql, std::vector<std::string> params,
+                        QueryCallback cb) {
+  {
+    std::lock_guard<std::mutex> locker(mtx_);
+    queue_.push_back(PendingQuery{std::move(sql), std::move(params),
+                                  std::move(cb)});
+  }
+  if (std::this_thread::get_id() == loop_thread_) {
+    Dispatch();
+  } else {
+    uint64_t one = 1;
+    ssize_t ret = write(event_fd_, &one, sizeof(one));
+    (void)ret;
+  }
+}
+
+bool SqlConnPool::Owns(int fd) const {
+  if (fd == event_fd_) {
+    return true;
+  }
+  for (const Conn& conn : conns_) {
+    if (conn.fd == fd) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* epoll事件转换为库的等待状态，继续被挂起的操作 */
+void SqlConnPool::DealEvent(int fd, uint32_t events) {
+  if (fd == event_fd_) {
+    uint64_t n;
+    ssize_t ret = read(event_fd_, &n, sizeof(n));
+    (void)ret;
+    Dispatch();
+    return;
+  }
+  for (size_t i = 0; i < conns_.size(); i++) {
+    if (conns_[i].fd != fd) {
+      continue;
+    }
+    timer_->Remove(fd);
+    if (conns_[i].state == IDLE) {
+      // 空闲时可读说明服务器关闭了连接(如wait_timeout)，有查询时再重连
+      LOG_INFO("Sql connection %d closed by server", fd);
+      CloseConn(i);
+      Dispatch();
+      return;
+    }
+    int status = 0;
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      status |= MYSQL_WAIT_READ;
+    }
+    if (events & EPOLLOUT) {
+      status |= MYSQL_WAIT_WRITE;
+    }
+    if (events & EPOLLPRI) {
+      status |= MYSQL_WAIT_EXCEPT;
+    }
+    Continue(i, status);
+    return;
+  }
+}
+
+int SqlConnPool::GetFreeConnCount() const {
+  int count = 0;
+  for (const Conn& conn : conns_) {
+    count += conn.state == IDLE;
+  }
+  return count;
+}
+
+/* 开始非阻塞地建立连接 */
+void SqlConnPool::Connect(size_t i) {
+  Conn& conn = conns_[i];
+  assert(conn.state == CLOSED);
+  conn.mysql = mysql_init(nullptr);
+  if (!conn.mysql) {
+    LOG_ERROR("mysql_init error");
+    FailQueued();
+    return;
+  }
+  mysql_options(conn.mysql, MYSQL_OPT_NONBLOCK, 0);
+  unsigned int timeout = kTimeoutS;
+  mysql_options(conn.mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+  mysql_options(conn.mysql, MYSQL_OPT_READ_TIMEOUT, &timeout);
+  mysql_options(conn.mysql, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+  conn.state = CONNECTING;
+  MYSQL* ret = nullptr;
+  int status = mysql_real_connect_start(
+      &ret, conn.mysql, host_.c_str(), user_.c_str(), pwd_.c_str(),
+      db_name_.c_str(), port_, nullptr, 0);
+  OnConnect(i, status, ret);
+}
+
+void SqlConnPool::OnConnect(size_t i, int status, MYSQL* ret) {
+  if (status) {
+    Wait(i, status);
+    return;
+  }
+  if (!ret) {
+    LOG_WARN("Sql connect error: %s", mysql_error(conns_[i].mysql));
+    CloseConn(i);
+    FailQueued();
+    return;
+  }
+  LOG_INFO("Sql connection %d established", conns_[i].fd);
+  conns_[i].state = IDLE;
+  WatchIdle(i);
+  Dispatch();
+}
+
+void SqlConnPool::StartQuery(size_t i, PendingQuery query) {
+  Conn& conn = conns_[i];
+  assert(conn.state == IDLE);
+  conn.sql = Bind(conn.mysql, query.sql, query.params);
+  conn.cb = std::move(query.cb);
+  conn.state = QUERYING;
+  int err = 0;
+  int status = mysql_real_query_start(&err, conn.mysql, conn.sql.data(),
+                                      conn.sql.size());
+  OnQuery(i, status, err);
+}
+
+/* 转义要知道连接的字符集，所以在确定由哪个连接执行后才拼接语句 */
+std::string SqlConnPool::Bind(MYSQL* mysql, const std::string& sql,
+                              const std::vector<std::string>& params) {
+  std::string bound;
+  size_t n_param = 0;
+  size_t begin = 0;
+  size_t pos;
+  while ((pos = sql.find('?', begin)) != std::string::npos) {
+    assert(n_param < params.size());
+    const std::string& param = params[n_param++];
+    bound.append(sql, begin, pos - begin);
+    // 值两边加单引号；最坏情况下每个字节都要转义，再加结尾的'\0'
+    size_t offset = bound.size() + 1;
+    bound.resize(offset + param.size() * 2 + 1);
+    bound[offset - 1] = '\'';
+    unsigned long len = mysql_real_escape_string(mysql, &bound[offset],
+                                                 param.data(), param.size());
+    bound.resize(offset + len);
+    bound.push_back('\'');
+    begin = pos + 1;
+  }
+  assert(n_param == params.size());
+  bound.append(sql, begin, std::string::npos);
+  return bound;
+}
+
+void SqlConnPool::OnQuery(size_t i, int status, int err) {
+  Conn& conn = conns_[i];
+  if (status) {
+    Wait(i, status);
+    return;
+  }
+  if (err) {
+    LOG_WARN("Sql query error: %s", mysql_error(conn.mysql));
+    Fail(i);
+    return;
+  }
+  // 没有结果集的语句(INSERT等)直接完成
+  if (mysql_field_count(conn.mysql) == 0) {
+    Finish(i, SqlResult{true, 0, mysql_affected_rows(conn.mysql)});
+    return;
+  }
+  conn.state = STORING;
+  MYSQL_RES* res = nullptr;
+  status = mysql_store_result_start(&res, conn.mysql);
+  OnStore(i, status, res);
+}
+
+void SqlConnPool::OnStore(size_t i, int status, MYSQL_RES* res) {
+  if (status) {
+    Wait(i, status);
+    return;
+  }
+  if (!res) {
+    LOG_WARN("Sql store result error: %s", mysql_error(conns_[i].mysql));
+    Fail(i);
+    return;
+  }
+  // 结果已全部读入内存，释放不需要再读套接字
+  uint64_t n_rows = mysql_num_rows(res);
+  mysql_free_result(res);
+  Finish(i, SqlResult{true, n_rows, 0});
+}
+
+void SqlConnPool::Continue(size_t i, int status) {
+  Conn& conn = conns_[i];
+  switch (conn.state) {
+    case CONNECTING: {
+      MYSQL* ret = nullptr;
+      int next = mysql_real_connect_cont(&ret, conn.mysql, status);
+      OnConnect(i, next, ret);
+      break;
+    }
+    case QUERYING: {
+      int err = 0;
+      int next = mysql_real_query_cont(&err, conn.mysql, status);
+      OnQuery(i, next, err);
+      break;
+    }
+    case STORING: {
+      MYSQL_RES* res = nullptr;
+      int next = mysql_store_result_cont(&res, conn.mysql, status);
+      OnStore(i, next, res);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/* 按库返回的等待状态注册套接字事件和超时 */
+void SqlConnPool::Wait(size_t i, int status) {
+  Conn& conn = conns_[i];
+  conn.fd = mysql_get_socket(conn.mysql);
+  uint32_t events = EPOLLONESHOT;
+  if (status & MYSQL_WAIT_READ) {
+    events |= EPOLLIN;
+  }
+  if (status & MYSQL_WAIT_WRITE) {
+    events |= EPOLLOUT;
+  }
+  if (status & MYSQL_WAIT_EXCEPT) {
+    events |= EPOLLPRI;
+  }
+  if (conn.registered) {
+    epoller_->ModFd(conn.fd, events);
+  } else {
+    conn.registered = epoller_->AddFd(conn.fd, events);
+  }
+  if (status & MYSQL_WAIT_TIMEOUT) {
+    timer_->Add(conn.fd, mysql_get_timeout_value_ms(conn.mysql),
+                [this, i] { Continue(i, MYSQL_WAIT_TIMEOUT); });
+  }
+}
+
+/* 空闲连接只关注对端关闭 */
+void SqlConnPool::WatchIdle(size_t i) {
+  Conn& conn = conns_[i];
+  conn.fd = mysql_get_socket(conn.mysql);
+  uint32_t events = EPOLLONESHOT | EPOLLIN | EPOLLRDHUP;
+  if (conn.registered) {
+    epoller_->ModFd(conn.fd, events);
+  } else {
+    conn.registered = epoller_->AddFd(conn.fd, events);
+  }
+}
+
+/* 先恢复连接状态再回调，回调中可以提交新的查询 */
+void SqlConnPool::Finish(size_t i, const SqlResult& result) {
+  Conn& conn = conns_[i];
+  QueryCallback cb = std::move(conn.cb);
+  conn.cb = nullptr;
+  conn.sql.clear();
+  conn.state = IDLE;
+  WatchIdle(i);
+  cb(result);
+  Dispatch();
+}
+
+/* 查询出错时关闭连接，不确定连接上是否还有未读完的数据 */
+void SqlConnPool::Fail(size_t i) {
+  QueryCallback cb = std::move(conns_[i].cb);
+  conns_[i].cb = nullptr;
+  CloseConn(i);
+  cb(SqlResult{false, 0, 0});
+  Dispatch();
+}
+
+/* 套接字出错时mysql_close发送的COM_QUIT立即失败，不会阻塞 */
+void SqlConnPool::CloseConn(size_t i) {
+  Conn& conn = conns_[i];
+  if (conn.fd >= 0) {
+    timer_->Remove(conn.fd);
+    if (conn.registered) {
+      epoller_->DelFd(conn.fd);
+    }
+  }
+  if (conn.mysql) {
+    mysql_close(conn.mysql);
+  }
+  conn.mysql = nullptr;
+  conn.fd = -1;
+  conn.registered = false;
+  conn.sql.clear();
+  conn.state = CLOSED;
+}
+
+/* 把排队的查询交给空闲连接；没有空闲连接时重连断开的连接，查询继续排队 */
+void SqlConnPool::Dispatch() {
+  while (true) {
+    size_t idle = conns_.size();
+    bool pending = false;
+    for (size_t i = 0; i < conns_.size(); i++) {
+      if (conns_[i].state == IDLE) {
+        idle = i;
+        break;
+      }
+      pending |= conns_[i].state != CLOSED;
+    }
+    PendingQuery query;
+    {
+      std::lock_guard<std::mutex> locker(mtx_);
+      if (queue_.empty()) {
+        return;
+      }
+      if (idle < conns_.size()) {
+        query = std::move(queue_.front());
+        queue_.pop_front();
+      }
+    }
+    if (idle < conns_.size()) {
+      StartQuery(idle, std::move(query));
+      continue;
+    }
+    if (!pending) {
+      for (size_t i = 0; i < conns_.size(); i++) {
+        if (conns_[i].state == CLOSED) {
+          Connect(i);
+        }
+      }
+    }
+    return;
+  }
+}
+
+/* 没有可用的连接，也没有正在建立的连接时，排队的查询全部失败 */
+void SqlConnPool::FailQueued() {
+  for (const Conn& conn : conns_) {
+    if (conn.state != CLOSED) {
+      return;
+    }
+  }
+  std::deque<PendingQuery> queue;
+  {
+    std::lock_guard<std::mutex> locker(mtx_);
+    queue.swap(queue_);
+  }
+  for (auto& query : queue) {
+    query.cb(SqlResult{false, 0, 0});
+  }
+}
@@ -2,36 +2,104 @@
 #define SQLCONNPOOL_H
 
 #include <mysql/mysql.h>
-#include <semaphore.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
+#include <deque>
+#include <functional>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
+#include "../utils/epoller.h"
+#include "../utils/timer.h"
+
+/* 一次查询的结果，只保留调用方需要的行数和影响的行数 */
+struct SqlResult {
+  bool ok;
+  uint64_t n_rows;         // 结果集的行数
+  uint64_t affected_rows;  // 没有结果集的语句影响的行数
+};
+
+/* 非阻塞的MySQL(MariaDB)连接池，属于一个反应堆
+连接设置MYSQL_OPT_NONBLOCK，用MariaDB Connector/C的mysql_xxx_start、mysql_xxx_cont接口驱动，
+库要求等待的事件注册在反应堆的epoll中，超时用反应堆的定时器，等待数据库时不占用任何线程；
+Query可以在任意线程调用，查询排队后由反应堆线程交给空闲连接执行，
+其他线程提交时通过eventfd唤醒反应堆；回调总是在反应堆线程中执行
+断开的连接在有查询排队时重新连接，所有连接都连不上时排队的查询直接失败
+*/
 class SqlConnPool {
  public:
-  static SqlConnPool* Instance();
+  typedef std::function<void(const SqlResult&)> QueryCallback;
+
+  SqlConnPool(Epoller* epoller, HeapTimer* timer);
+  ~SqlConnPool();
+
+  /* 注册eventfd并开始建立conn_size个连接，不等待连接完成 */
+  bool Init(const char* host, int port, const char* user, const char* pwd,
+            const char* db_name, int conn_size);
+  /* 反应堆线程开始运行时调用，之后在该线程中提交的查询不需要经过eventfd */
+  inline void SetLoopThread() { loop_thread_ = std::this_thread::get_id(); }
 
-  MYSQL* GetConn();
-  void FreeConn(MYSQL* conn);
-  int GetFreeConnCount();
+  /* sql中的?依次替换为params中的值，sql本身不能再含有?；
+  值在执行前由执行它的连接按连接的字符集转义(mysql_real_escape_string)并加上单引号
+  */
+  void Query(std::string sql, std::vector<std::string> params,
+             QueryCallback cb);
 
-  void Init(const char* host, int port, const char* user, const char* pwd,
-            const char* dbName, int connSize);
-  void ClosePool();
+  /* 以下只在反应堆线程中调用 */
+  bool Owns(int fd) const;
+  void DealEvent(int fd, uint32_t events);
+
+  int GetFreeConnCount() const;
 
  private:
-  SqlConnPool();
-  ~SqlConnPool();
+  enum CONN_STATE { CLOSED = 0, CONNECTING, IDLE, QUERYING, STORING };
+  struct PendingQuery {
+    std::string sql;
+    std::vector<std::string> params;
+    QueryCallback cb;
+  };
+  struct Conn {
+    Conn() : mysql(nullptr), fd(-1), state(CLOSED), registered(false) {}
+    MYSQL* mysql;
+    int fd;
+    CONN_STATE state;
+    bool registered;  // 套接字是否已加入epoll
+    std::string sql;  // 执行期间库会引用查询语句
+    QueryCallback cb;
+  };
+  // 连接、读写的超时秒数，超时后库返回错误
+  static const unsigned kTimeoutS = 5;
 
-  int MAX_CONN_;
-  int useCount_;
-  int freeCount_;
+  void Connect(size_t i);
+  void OnConnect(size_t i, int status, MYSQL* ret);
+  void StartQuery(size_t i, PendingQuery query);
+  static std::string Bind(MYSQL* mysql, const std::string& sql,
+                          const std::vector<std::string>& params);
+  void OnQuery(size_t i, int status, int err);
+  void OnStore(size_t i, int status, MYSQL_RES* res);
+  void Continue(size_t i, int status);
+  void Wait(size_t i, int status);
+  void WatchIdle(size_t i);
+  void Finish(size_t i, const SqlResult& result);
+  void Fail(size_t i);
+  void CloseConn(size_t i);
+  void Dispatch();
+  void FailQueued();
 
-  std::queue<MYSQL*> connQue_;
+  std::string host_, user_, pwd_, db_name_;
+  int port_;
+  std::vector<Conn> conns_;
+  Epoller* epoller_;
+  HeapTimer* timer_;
+  int event_fd_;
+  std::thread::id loop_thread_;
+  // 等待空闲连接的查询，其他线程也会访问
   std::mutex mtx_;
-  sem_t semId_;
+  std::deque<PendingQuery> queue_;
 };
 
-#endif
\ No newline at end of file
+#endif
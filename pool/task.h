@@ -0,0 +1,137 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <assert.h>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* 固定大小的任务对象，相当于只能移动的std::function<void()>
+不超过kInlineSize、可以无异常移动的可调用对象直接存放在对象内部，不分配内存，
+反应堆提交的[this, conn]任务都属于这种；更大的可调用对象才放到堆上
+*/
+class Task {
+ public:
+  static const size_t kInlineSize = 4 * sizeof(void*);
+
+  Task() : ops_(nullptr) {}
+  Task(std::nullptr_t) : ops_(nullptr) {}
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<F>::type, Task>::value>::type>
+  Task(F&& f) {
+    typedef typename std::decay<F>::type Func;
+    Construct<Func>(std::forward<F>(f),
+                    std::integral_constant<bool, IsInline<Func>()>());
+  }
+
+  Task(Task&& other) noexcept : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(&storage_, &other.storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      if (other.ops_) {
+        ops_ = other.ops_;
+        ops_->move(&storage_, &other.storage_);
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  Task& operator=(std::nullptr_t) {
+    Reset();
+    return *this;
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() { Reset(); }
+
+  inline void operator()() {
+    assert(ops_);
+    ops_->invoke(&storage_);
+  }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+ private:
+  typedef std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type
+      Storage;
+
+  /* 按可调用对象的类型生成的操作表，Task中只保存一个指针 */
+  struct Ops {
+    void (*invoke)(void* storage);
+    void (*move)(void* dst, void* src);  // 移动后销毁src
+    void (*destroy)(void* storage);
+  };
+
+  template <typename F>
+  static constexpr bool IsInline() {
+    return sizeof(F) <= sizeof(Storage) && alignof(F) <= alignof(Storage) &&
+           std::is_nothrow_move_constructible<F>::value;
+  }
+
+  template <typename F>
+  struct InlineOps {
+    static void Invoke(void* storage) { (*static_cast<F*>(storage))(); }
+    static void Move(void* dst, void* src) {
+      new (dst) F(std::move(*static_cast<F*>(src)));
+      static_cast<F*>(src)->~F();
+    }
+    static void Destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+    static const Ops kOps;
+  };
+
+  template <typename F>
+  struct HeapOps {
+    static void Invoke(void* storage) { (**static_cast<F**>(storage))(); }
+    static void Move(void* dst, void* src) {
+      *static_cast<F**>(dst) = *static_cast<F**>(src);
+    }
+    static void Destroy(void* storage) { delete *static_cast<F**>(storage); }
+    static const Ops kOps;
+  };
+
+  template <typename F, typename Arg>
+  void Construct(Arg&& f, std::true_type) {
+    new (&storage_) F(std::forward<Arg>(f));
+    ops_ = &InlineOps<F>::kOps;
+  }
+
+  template <typename F, typename Arg>
+  void Construct(Arg&& f, std::false_type) {
+    *reinterpret_cast<F**>(&storage_) = new F(std::forward<Arg>(f));
+    ops_ = &HeapOps<F>::kOps;
+  }
+
+  inline void Reset() {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  const Ops* ops_;
+  Storage storage_;
+};
+
+template <typename F>
+const Task::Ops Task::InlineOps<F>::kOps = {&InlineOps<F>::Invoke,
+                                            &InlineOps<F>::Move,
+                                            &InlineOps<F>::Destroy};
+
+template <typename F>
+const Task::Ops Task::HeapOps<F>::kOps = {
+    &HeapOps<F>::Invoke, &HeapOps<F>::Move, &HeapOps<F>::Destroy};
+
+#endif
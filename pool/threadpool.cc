@@ -2,44 +2,219 @@
 
 #include <iostream>
 
+static long Futex(std::atomic<int>* addr, int op, int val) {
+  return syscall(SYS_futex, reinterpret_cast<int*>(addr), op, val, nullptr,
+                 nullptr, 0);
+}
+
+ThreadPool::TaskQueue::TaskQueue()
+    : cells_(new Cell[kCapacity]), tail_(0), head_(0) {
+  for (size_t i = 0; i < kCapacity; i++) {
+    cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+}
+
+/* 槽位序号等于位置时可写，写入后序号加一表示可读；队列满时返回false */
+bool ThreadPool::TaskQueue::Push(Task& task) {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells_[pos & (kCapacity - 1)];
+    size_t seq = cell.seq.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        cell.task = std::move(task);
+        cell.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+/* 槽位序号等于位置加一时可读，取出后序号加上容量，留给下一圈的生产者 */
+bool ThreadPool::TaskQueue::Pop(Task* task) {
+  size_t pos = head_.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells_[pos & (kCapacity - 1)];
+    size_t seq = cell.seq.load(std::memory_order_acquire);
+    intptr_t diff =
+        static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        *task = std::move(cell.task);
+        cell.seq.store(pos + kCapacity, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
 /* 初始化每一个工作线程 */
-ThreadPool::ThreadPool(size_t thread_cnt) : pool_(std::make_shared<Pool>()) {
+ThreadPool::ThreadPool(size_t thread_cnt)
+    : n_overflow_(0), n_sleeping_(0), closed_(false) {
   assert(thread_cnt > 0);
-  // 启动每一个工作线程
   for (size_t i = 0; i < thread_cnt; i++) {
-    std::thread([&] {
-      std::unique_lock<std::mutex> locker(pool_->mtx);
-      while (true) {
-        // 如果有新任务
-        if (!pool_->tasks.empty()) {
-          /* 左值和右值
-          左值是表达式结束后依然存在的持久对象（在内存中有确定的位置，可以取地址）
-          右值是表达式结束后不再存在的临时对象（在内存中的位置不确定，不可取地址）
-          move函数可以将左值转为右值，可以避免拷贝，从而提高性能
-          */
-          auto task = std::move(pool_->tasks.front());
-          pool_->tasks.pop();
-          // 取到任务就可以解锁了
-          locker.unlock();
-          // 执行任务
-          task();
-          locker.lock();
-        } else if (pool_->closed) {  // 线程池被关闭，退出循环
-          break;
-        } else {  // 任务队列为空，等待新任务
-          pool_->cond.wait(locker);
-        }
-      }
-    }).detach();
+    workers_.emplace_back(new Worker());
+  }
+  // 队列都建好后再启动，工作线程窃取时会访问所有队列
+  for (size_t i = 0; i < thread_cnt; i++) {
+    workers_[i]->thread = std::thread(&ThreadPool::Run, this, i);
   }
 }
 
-/* 析构函数终止所有线程 */
+/* 析构函数等所有线程执行完剩余任务后退出 */
 ThreadPool::~ThreadPool() {
-  if (static_cast<bool>(pool_)) {
-    std::lock_guard<std::mutex> locker(pool_->mtx);
-    pool_->closed = true;
-    pool_->cond.notify_all();
+  closed_.store(true);
+  for (auto& worker : workers_) {
+    worker->state.store(NOTIFIED);
+    Futex(&worker->state, FUTEX_WAKE_PRIVATE, 1);
+  }
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+/* 每个生产者线程轮流放入各个队列，计数器是线程私有的，不争用
+返回放入的队列，用于优先唤醒它的主人
+*/
+size_t ThreadPool::Enqueue(Task& task) {
+  static thread_local size_t next = std::hash<std::thread::id>()(
+      std::this_thread::get_id());
+  size_t n = workers_.size();
+  size_t start = next++ % n;
+  for (size_t i = 0; i < n; i++) {
+    if (workers_[(start + i) % n]->queue.Push(task)) {
+      return (start + i) % n;
+    }
+  }
+  // 所有队列都满了，放入加锁的后备队列
+  std::lock_guard<std::mutex> locker(overflow_mtx_);
+  overflow_.push(std::move(task));
+  n_overflow_++;
+  return start;
+}
+
+void ThreadPool::AddTasks(Task* tasks, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  size_t first = Enqueue(tasks[0]);
+  for (size_t i = 1; i < n; i++) {
+    Enqueue(tasks[i]);
+  }
+  Notify(first, n);
+}
+
+/* 放入n个任务后唤醒最多n个睡眠的线程
+与Park中的检查构成Dekker式的配对：
+要么这里看到有线程在睡眠去唤醒它，要么睡眠前的检查看到这些任务
+*/
+void ThreadPool::Notify(size_t preferred, size_t n) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int sleeping = n_sleeping_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n && sleeping > 0; i++, sleeping--) {
+    WakeOne(preferred + i);
+  }
+}
+
+/* 先取自己的队列，再从随机位置开始依次窃取其他队列，最后看后备队列 */
+bool ThreadPool::TryPop(size_t self, unsigned* seed, Task* task) {
+  if (workers_[self]->queue.Pop(task)) {
+    return true;
+  }
+  size_t n = workers_.size();
+  // xorshift，每个线程自己的随机数状态
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  size_t start = *seed % n;
+  for (size_t i = 0; i < n; i++) {
+    size_t victim = (start + i) % n;
+    if (victim != self && workers_[victim]->queue.Pop(task)) {
+      return true;
+    }
+  }
+  if (n_overflow_.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> locker(overflow_mtx_);
+    if (!overflow_.empty()) {
+      *task = std::move(overflow_.front());
+      overflow_.pop();
+      n_overflow_--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::HasTask() const {
+  for (auto& worker : workers_) {
+    if (!worker->queue.Empty()) {
+      return true;
+    }
+  }
+  return n_overflow_.load(std::memory_order_relaxed) > 0;
+}
+
+/* 没有任务时睡眠，先声明要睡眠再检查一遍队列，不会错过检查前放入的任务 */
+void ThreadPool::Park(Worker& worker) {
+  worker.state.store(SLEEPING);
+  n_sleeping_.fetch_add(1);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!HasTask() && !closed_.load()) {
+    while (worker.state.load() == SLEEPING) {
+      Futex(&worker.state, FUTEX_WAIT_PRIVATE, SLEEPING);
+    }
+  }
+  n_sleeping_.fetch_sub(1);
+  worker.state.store(RUNNING);
+}
+
+/* 唤醒一个睡眠的线程，优先唤醒刚放入任务的队列的主人 */
+void ThreadPool::WakeOne(size_t preferred) {
+  size_t n = workers_.size();
+  for (size_t i = 0; i < n; i++) {
+    Worker& worker = *workers_[(preferred + i) % n];
+    int expected = SLEEPING;
+    if (worker.state.compare_exchange_strong(expected, NOTIFIED)) {
+      Futex(&worker.state, FUTEX_WAKE_PRIVATE, 1);
+      return;
+    }
+  }
+}
+
+void ThreadPool::Run(size_t self) {
+  // 自旋几轮再睡眠，任务密集时不必每次都经过futex
+  static const int kSpinRounds = 64;
+  unsigned seed = static_cast<unsigned>(self) * 2654435761u + 1;
+  Task task;
+  while (true) {
+    bool found = false;
+    for (int i = 0; i < kSpinRounds && !found; i++) {
+      found = TryPop(self, &seed, &task);
+      if (!found) {
+        std::this_thread::yield();
+      }
+    }
+    if (found) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    // 线程池被关闭且没有剩余任务，退出循环
+    if (closed_.load() && !HasTask()) {
+      break;
+    }
+    Park(*workers_[self]);
   }
 }
 
@@ -51,7 +226,5 @@ int main_threadpool() {
         std::cout << "therad " << j << " print " << i << std::endl;
     });
   }
-  // 等所有线程退出后进程才结束
-  pthread_exit(NULL);
   return 0;
-}
\ No newline at end of file
+}
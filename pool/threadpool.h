@@ -1,13 +1,28 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
 #include <assert.h>
+#include <linux/futex.h>
 #include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-#include <condition_variable>
-#include <deque>
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
-#include "sqlconnpool.h"
+#include <thread>
+#include <vector>
+
+#include "task.h"
 
+/* 工作窃取线程池
+每个工作线程有自己的无锁任务队列，AddTask轮流放入各个队列，不争用同一把锁；
+一批任务可以用AddTasks一起提交，只检查和唤醒一次；
+工作线程先取自己队列中的任务，没有时从随机选中的其他队列窃取，
+都没有时才睡眠在自己的futex上，添加任务时只在有线程睡眠时才需要系统调用唤醒
+*/
 class ThreadPool {
  public:
   ThreadPool(size_t thread_cnt = 8);
@@ -15,29 +30,70 @@ class ThreadPool {
   template <typename T>
   /* 添加新任务，task需要可执行，一般用bind函数生成 */
   void AddTask(T&& task) {
-    /* lock_guard在生命周期内一直加锁，结束后自动解锁，即RAII技术，不用担心异常安全问题。
-    lock_guard没有提供构造、析构函数以外的接口，如果想要更灵活，可以使用unique_lock
-     */
-    std::lock_guard<std::mutex> locker(pool_->mtx);
-    /* 需要再学习下左右值 */
-    pool_->tasks.emplace(std::forward<T>(task));
-    /* notify_one只唤醒等待队列中的第一个线程，不存在锁争用，其余线程不会被唤醒
-    notify_all唤醒所有等待队列的线程，存在锁争用。
-    这里唤醒一个工作线程就可以了 */
-    pool_->cond.notify_one();
+    Task t(std::forward<T>(task));
+    Notify(Enqueue(t), 1);
   }
 
-  ThreadPool(ThreadPool&&) = default;
+  /* 一次提交n个任务，任务被移走 */
+  void AddTasks(Task* tasks, size_t n);
+
+  ThreadPool(ThreadPool&&) = delete;
   ~ThreadPool();
 
  private:
-  /* 线程共享结构 */
-  struct Pool {
-    std::mutex mtx;                           // 互斥访问
-    std::condition_variable cond;             // 同步工作
-    bool closed;                              // 标记线程池关闭状态
-    std::queue<std::function<void()>> tasks;  // 任务队列
+  /* 有界多生产者多消费者无锁队列(Vyukov)
+  每个槽位带序号，生产者和消费者各自用CAS占用位置，之后只操作自己占到的槽位
+  */
+  class TaskQueue {
+   public:
+    static const size_t kCapacity = 1024;
+
+    TaskQueue();
+    bool Push(Task& task);
+    bool Pop(Task* task);
+    inline bool Empty() const {
+      return head_.load(std::memory_order_acquire) ==
+             tail_.load(std::memory_order_acquire);
+    }
+
+   private:
+    struct Cell {
+      std::atomic<size_t> seq;
+      Task task;
+    };
+    std::unique_ptr<Cell[]> cells_;
+    // 生产者和消费者的位置分开放在不同的缓存行
+    std::atomic<size_t> tail_;
+    char pad_[64];
+    std::atomic<size_t> head_;
   };
 
-  std::shared_ptr<Pool> pool_;
-};
\ No newline at end of file
+  /* 工作线程：自己的任务队列和睡眠用的futex字 */
+  struct Worker {
+    Worker() : state(RUNNING) {}
+    TaskQueue queue;
+    std::atomic<int> state;
+    std::thread thread;
+    char pad[64];  // 与相邻分配的Worker不共享缓存行
+  };
+  enum WORKER_STATE { RUNNING = 0, SLEEPING, NOTIFIED };
+
+  size_t Enqueue(Task& task);
+  void Notify(size_t preferred, size_t n);
+  bool TryPop(size_t self, unsigned* seed, Task* task);
+  bool HasTask() const;
+  void Park(Worker& worker);
+  void WakeOne(size_t preferred);
+  void Run(size_t self);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // 所有队列都满时的后备队列
+  std::mutex overflow_mtx_;
+  std::queue<Task> overflow_;
+  std::atomic<size_t> n_overflow_;
+  // 正在睡眠的线程数，为0时添加任务不需要唤醒
+  std::atomic<int> n_sleeping_;
+  std::atomic<bool> closed_;
+};
+
+#endif
@@ -0,0 +1,376 @@
+#include "reactor.h"
+
+Reactor::Reactor(int listen_fd, uint32_t listen_event_type,
+                 uint32_t conn_event_type, int timeout_ms,
+                 ConnPool* conns, ThreadPool* threadpool)
+    : closed_(false),
+      listen_fd_(listen_fd),
+      listen_event_type_(listen_event_type),
+      conn_event_type_(conn_event_type),
+      timeout_ms_(timeout_ms),
+      threadpool_(threadpool),
+      timer_(new HeapTimer()),
+      idle_timer_(new HeapTimer()),
+      conns_(conns) {}
+
+Reactor::~Reactor() {
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+}
+
+/* 注册监听套接字 */
+bool Reactor::Init() {
+  epoller_.reset(new Epoller());
+  if (!epoller_->AddFd(listen_fd_, listen_event_type_ | EPOLLIN)) {
+    LOG_ERROR("Add listen error!");
+    return false;
+  }
+  return true;
+}
+
+/* 创建数据库连接池，连接在事件循环中异步建立 */
+bool Reactor::InitSql(const char* host, int port, const char* user,
+                      const char* pwd, const char* db_name, int conn_num) {
+  assert(epoller_);
+  sql_.reset(new SqlConnPool(epoller_.get(), timer_.get()));
+  if (!sql_->Init(host, port, user, pwd, db_name, conn_num)) {
+    sql_.reset();
+    return false;
+  }
+  return true;
+}
+
+void Reactor::Loop() {
+  int timeout_ms = -1;  // 阻塞等待
+  if (sql_) {
+    sql_->SetLoopThread();
+  }
+
+  // 事件监听循环
+  while (!closed_) {
+    // 关闭超时连接、释放空闲连接，并以最近的过期时间作为epoll_wait的超时；数据库的超时也在定时器中
+    timeout_ms = GetNextTick();
+    // 到期的数据库回调可能产生了恢复连接的任务，不能等到下一次事件
+    FlushPending();
+
+    // 获取时间数
+    int n_event = epoller_->Wait(timeout_ms);
+    // 处理就绪事件
+    for (int i = 0; i < n_event; i++) {
+      // 获取事件的fd和type
+      int fd = epoller_->GetEventFd(i);
+      uint32_t events_type = epoller_->GetEventsType(i);
+
+      if (fd == listen_fd_) {  // 有新用户连接
+        DealListen();
+        continue;
+      }
+      if (sql_ && sql_->Owns(fd)) {
+        sql_->DealEvent(fd, events_type);
+        continue;
+      }
+      // 同一批事件中fd已被关闭并复用，丢弃旧连接的事件
+      if (!conns_->IsValid(fd, epoller_->GetEventGeneration(i))) {
+        LOG_DEBUG("Stale event on fd %d", fd);
+        continue;
+      }
+      HttpConnection* conn = conns_->Get(fd);
+
+      // 判断每个类型属于什么类型
+      if (events_type & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {  // 异常事件
+        // 处理异常并关闭连接
+        DealException(conn);
+      } else if (events_type & EPOLLIN) {
+        // 处理请求
+        DealRead(conn);
+      } else if (events_type & EPOLLOUT) {
+        // 处理响应
+        DealWrite(conn);
+      } else {
+        LOG_ERROR("Unexpected event");
+      }
+    }
+    FlushPending();
+  }
+}
+
+/* 一次提交，只检查和唤醒一次工作线程 */
+void Reactor::FlushPending() {
+  if (!pending_.empty()) {
+    threadpool_->AddTasks(pending_.data(), pending_.size());
+    pending_.clear();
+  }
+}
+
+/* 两个定时器中最近的过期时间，都没有时返回-1 */
+int Reactor::GetNextTick() {
+  int timeout_ms = timer_->GetNextTick();
+  int idle_ms = idle_timer_->GetNextTick();
+  if (timeout_ms < 0 || (idle_ms >= 0 && idle_ms < timeout_ms)) {
+    return idle_ms;
+  }
+  return timeout_ms;
+}
+
+void Reactor::CloseConnection(HttpConnection* conn) {
+  assert(conn);
+  // 线程池模式下工作线程关闭连接后定时器会残留，到期时连接已关闭，
+  // fd可能已被数据库连接等复用，不能再从epoll中删除
+  if (conn->IsClosed()) {
+    return;
+  }
+  LOG_INFO("Client[%d] quit!", conn->GetFd());
+  // 线程池模式下可能在工作线程中调用，定时器只能由反应堆线程修改，
+  // 残留的定时器在到期时丢弃，fd被新客户复用时AddClient会覆盖它
+  if (!threadpool_) {
+    timer_->Remove(conn->GetFd());
+    idle_timer_->Remove(conn->GetFd());
+  }
+  // 删除对应的文件描述符
+  epoller_->DelFd(conn->GetFd());
+  // 清理其他连接信息
+  conn->Close();
+}
+
+/* 事件来自epoll，连接已由上一个工作线程交还，在反应堆线程中关闭前同样要接手 */
+void Reactor::DealException(HttpConnection* conn) {
+  if (threadpool_) {
+    conn->SetDispatched(true);
+  }
+  CloseConnection(conn);
+}
+
+/* 处理用户新请求
+accept4直接得到非阻塞、close-on-exec的套接字，省去两次fcntl；
+两种模式都循环接受到EAGAIN，每次唤醒最多接受kAcceptBudget个连接，
+避免连接风暴时饿死已有连接的读写。水平模式下剩下的连接在下一次epoll_wait时再次触发
+*/
+void Reactor::DealListen() {
+  struct sockaddr_in addr;
+  socklen_t len;
+  int n_accept = 0;
+  do {
+    len = sizeof(addr);
+    int fd = accept4(listen_fd_, (struct sockaddr*)&addr, &len,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    // 连接失败或已接受完
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        LOG_WARN("Accept error: %d", errno);
+      }
+      return;
+    }
+    n_accept++;
+    if (HttpConnection::user_count_ >= kMaxFd ||
+        static_cast<size_t>(fd) >= conns_->Capacity()) {
+      // 超过最大连接数或连接表容量
+      SendError(fd, "Server busy!");
+      LOG_WARN("The number of client connections exceeds the limit");
+      continue;
+    }
+    AddClient(fd, addr);
+  } while (n_accept < kAcceptBudget);
+
+  // 边缘模式下预算用完时可能还有未接受的连接，重新注册以再次触发
+  if ((listen_event_type_ & EPOLLET) && n_accept >= kAcceptBudget) {
+    epoller_->ModFd(listen_fd_, listen_event_type_ | EPOLLIN);
+  }
+}
+
+/* 给客户发送错误信息 */
+void Reactor::SendError(int fd, const char* info) {
+  assert(fd > 0);
+  int ret = send(fd, info, strlen(info), 0);
+  if (ret < 0) {
+    LOG_WARN("Failed to send error to client[%d] ", fd);
+  }
+  close(fd);
+}
+
+/* 添加新客户 */
+void Reactor::AddClient(int fd, sockaddr_in addr) {
+  assert(fd > 0);
+  // 复用槽位中的连接对象，初始化
+  uint32_t generation = conns_->Acquire(fd);
+  HttpConnection* conn = conns_->Get(fd);
+  conn->Init(fd, addr);
+  idle_timer_->Remove(fd);
+  if (timeout_ms_ > 0) {
+    timer_->Add(fd, timeout_ms_, std::bind(&Reactor::CloseExpired, this, conn));
+  }
+  // EPOLLIN指示可读时触发事件，可读意味着客户发来了新请求
+  epoller_->AddFd(fd, EPOLLIN | conn_event_type_, generation);
+  LOG_INFO("Client[%d] connected.", conn->GetFd());
+}
+
+/* 默认情况下socket是blocking的，等待accept、recv、send、connect一系列函数执行完才能返回
+可使用fcntl函数将socket设置为非阻塞，这样函数就可以立即返回了，不用等待满足条件才返回，提高并发效率
+F_SETFD：设置文件描述词标志
+F_GETFD：读取文件描述词标志。
+F_GETFL：读取文件状态标志
+F_SETFL：设置文件状态标志
+这几个参数的区别仍不太了解
+*/
+int Reactor::SetSocketNonBlocking(int fd) {
+  assert(fd > 0);
+  // return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+  // 据说这才是正确用法，但两种结果都一样
+  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+void Reactor::read(HttpConnection* conn) {
+  assert(conn);
+  int ret = -1;
+  int read_errno = 0;
+  ret = conn->read(&read_errno);
+  // 没能读取到数据，关闭连接
+  if (ret <= 0 && read_errno != EAGAIN) {
+    CloseConnection(conn);
+    return;
+  }
+  ModClientFdEvent(conn);
+}
+
+void Reactor::write(HttpConnection* conn) {
+  assert(conn);
+  int ret = -1;
+  int write_errno = 0;
+  ret = conn->write(&write_errno);
+  // 传输完成
+  if (conn->ToWriteBytes() == 0) {
+    if (conn->IsKeepAlive()) {
+      ModClientFdEvent(conn);
+      return;
+    }
+  } else if (ret < 0) {
+    // 继续传输
+    if (write_errno == EAGAIN) {
+      RearmFd(conn, EPOLLOUT);
+      return;
+    }
+  }
+  CloseConnection(conn);
+}
+
+/* 超时定时器到期，在反应堆线程中执行
+线程池模式下连接可能正在工作线程中处理，不能在这里关闭，推迟到下一个超时周期
+*/
+void Reactor::CloseExpired(HttpConnection* conn) {
+  if (conn->IsClosed()) {
+    return;
+  }
+  if (conn->IsDispatched()) {
+    timer_->Add(conn->GetFd(), timeout_ms_,
+                std::bind(&Reactor::CloseExpired, this, conn));
+    return;
+  }
+  CloseConnection(conn);
+}
+
+/* 连接有活动，推迟其超时时间；空闲释放的定时器到期后就删除了，有活动时重新添加 */
+void Reactor::ExtentTime(HttpConnection* conn) {
+  assert(conn);
+  if (timeout_ms_ > 0) {
+    timer_->Adjust(conn->GetFd(), timeout_ms_);
+  }
+  idle_timer_->Add(conn->GetFd(), kIdleReleaseMs,
+                   [this, conn] { ReleaseIdle(conn); });
+}
+
+/* 连接已空闲kIdleReleaseMs，只剩连接对象本身，下一个请求到来时再分配
+线程池模式下连接还在工作线程中时稍后再检查；没有空闲(如响应还没写完)时等下一次活动
+*/
+void Reactor::ReleaseIdle(HttpConnection* conn) {
+  if (conn->IsClosed()) {
+    return;
+  }
+  if (conn->IsDispatched()) {
+    idle_timer_->Add(conn->GetFd(), kIdleReleaseMs,
+                     [this, conn] { ReleaseIdle(conn); });
+    return;
+  }
+  if (conn->IsIdle()) {
+    conn->ReleaseIdle();
+  }
+}
+
+void Reactor::DealRead(HttpConnection* conn) {
+  ExtentTime(conn);
+  if (threadpool_) {
+    conn->SetDispatched(true);
+    pending_.emplace_back([this, conn] { read(conn); });
+  } else {
+    read(conn);
+  }
+}
+
+void Reactor::DealWrite(HttpConnection* conn) {
+  ExtentTime(conn);
+  if (threadpool_) {
+    conn->SetDispatched(true);
+    pending_.emplace_back([this, conn] { write(conn); });
+  } else {
+    write(conn);
+  }
+}
+
+/* 修改客户描述符事件类型 */
+void Reactor::ModClientFdEvent(HttpConnection* conn) {
+  AfterProcess(conn, conn->Process());
+}
+
+/* 处理完请求后根据结果注册事件；等待数据库时不注册，查询返回后再继续 */
+void Reactor::AfterProcess(HttpConnection* conn, bool has_response) {
+  if (conn->IsWaiting()) {
+    VerifyUser(conn);
+    return;
+  }
+  if (has_response) {
+    // 本线程处理时直接尝试写，写不完(EAGAIN)再注册EPOLLOUT，省一次epoll_wait
+    if (!threadpool_) {
+      write(conn);
+      return;
+    }
+    RearmFd(conn, EPOLLOUT);
+  } else {
+    RearmFd(conn, EPOLLIN);
+  }
+}
+
+/* 把连接交还给epoll，之后不再访问连接，之后的事件可能已经在别的工作线程中处理，
+连接也可能已被关闭、槽位被新连接复用，所以fd和generation要在交还前取出
+*/
+void Reactor::RearmFd(HttpConnection* conn, uint32_t event) {
+  int fd = conn->GetFd();
+  uint32_t generation = conns_->GetGeneration(fd);
+  conn->SetDispatched(false);
+  epoller_->ModFd(fd, conn_event_type_ | event, generation);
+}
+
+/* 提交登录、注册的查询，线程池模式下可能在工作线程中调用
+回调在反应堆线程中执行，连接可能已经超时关闭，槽位也可能已被新连接复用，
+用generation确认还是同一个连接
+*/
+void Reactor::VerifyUser(HttpConnection* conn) {
+  int fd = conn->GetFd();
+  uint32_t generation = conns_->GetGeneration(fd);
+  std::vector<string> params;
+  string sql = conn->GetUserQuery(&params);
+  sql_->Query(std::move(sql), std::move(params),
+              [this, conn, fd, generation](const SqlResult& result) {
+                if (!conns_->IsValid(fd, generation) || conn->IsClosed()) {
+                  return;
+                }
+                // 登录要查到用户，注册要插入一行(用户名已存在时不插入)
+                bool verified = result.ok && (result.n_rows > 0 ||
+                                              result.affected_rows > 0);
+                if (threadpool_) {
+                  pending_.emplace_back([this, conn, verified] {
+                    AfterProcess(conn, conn->Resume(verified));
+                  });
+                } else {
+                  AfterProcess(conn, conn->Resume(verified));
+                }
+              });
+}
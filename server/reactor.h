@@ -0,0 +1,83 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <fcntl.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "../http/connection.h"
+#include "../log/logger.h"
+#include "../pool/connpool.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/threadpool.h"
+#include "../utils/epoller.h"
+#include "../utils/timer.h"
+
+/* 反应堆：一个Epoller + 一个监听套接字 + 属于它的全部连接(存放在共享的连接表中)
+threadpool为空时在本线程内直接完成读、解析、写（one loop per thread），
+否则把读写任务交给线程池（单反应堆模式）
+*/
+class Reactor {
+ public:
+  Reactor(int listen_fd, uint32_t listen_event_type, uint32_t conn_event_type,
+          int timeout_ms, ConnPool* conns, ThreadPool* threadpool);
+  virtual ~Reactor();
+
+  virtual bool Init();
+  /* Init之后调用，数据库连接注册在本反应堆的epoll中，登录、注册的查询在本反应堆完成 */
+  bool InitSql(const char* host, int port, const char* user, const char* pwd,
+               const char* db_name, int conn_num);
+  virtual void Loop();
+
+  static int SetSocketNonBlocking(int fd);
+  static const int kMaxFd = 65536;
+  // 每次唤醒最多接受的连接数
+  static const int kAcceptBudget = 64;
+  // 连接没有活动超过该时间后释放它的缓冲区、请求和响应
+  static const int kIdleReleaseMs = 3000;
+
+ protected:
+  virtual void CloseConnection(HttpConnection* conn);
+  virtual void AddClient(int fd, sockaddr_in addr);
+  void SendError(int fd, const char* info);
+  void ExtentTime(HttpConnection* conn);
+  void CloseExpired(HttpConnection* conn);
+  void ReleaseIdle(HttpConnection* conn);
+  int GetNextTick();
+
+ private:
+  void DealRead(HttpConnection* conn);
+  void read(HttpConnection* conn);
+  void write(HttpConnection* conn);
+  void DealWrite(HttpConnection* conn);
+  void DealException(HttpConnection* conn);
+  void ModClientFdEvent(HttpConnection* conn);
+  void AfterProcess(HttpConnection* conn, bool has_response);
+  void RearmFd(HttpConnection* conn, uint32_t event);
+  void VerifyUser(HttpConnection* conn);
+  void DealListen();
+  void FlushPending();
+
+ protected:
+  bool closed_;
+  int listen_fd_;
+  uint32_t listen_event_type_, conn_event_type_;
+  // 空闲连接超时时间，<= 0 表示不启用定时器
+  int timeout_ms_;
+  // 不为空时读写交给线程池，否则在反应堆线程内处理
+  ThreadPool* threadpool_;
+  // 一轮就绪事件产生的读写任务，处理完这一轮后一起提交给线程池
+  std::vector<Task> pending_;
+  std::unique_ptr<Epoller> epoller_;
+  std::unique_ptr<HeapTimer> timer_;
+  // 空闲连接的内存释放，与超时关闭分开，不受timeout_ms_影响
+  std::unique_ptr<HeapTimer> idle_timer_;
+  // 所有反应堆共享的连接表，按fd索引
+  ConnPool* conns_;
+  // 本反应堆的数据库连接，为空表示不验证用户；析构时要用到epoller_和timer_，须声明在它们之后
+  std::unique_ptr<SqlConnPool> sql_;
+};
+
+#endif
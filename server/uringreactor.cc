@@ -0,0 +1,253 @@
+#include "uringreactor.h"
+
+UringReactor::UringReactor(int listen_fd, int timeout_ms, ConnPool* conns)
+    : Reactor(listen_fd, 0, 0, timeout_ms, conns, nullptr),
+      fd_states_(conns->Capacity()) {}
+
+/* 创建io_uring、注册缓冲区并开始接受连接，内核不支持时返回false */
+bool UringReactor::Init() {
+  ring_.reset(new IoUring());
+  if (!ring_->Init()) {
+    LOG_WARN("io_uring setup error: %d", errno);
+    return false;
+  }
+  if (!ring_->SetupBufRing(kBufCount, kBufSize, kBufGroup)) {
+    LOG_WARN("io_uring provided buffer ring error: %d", errno);
+    return false;
+  }
+  ring_->PrepAcceptMultishot(listen_fd_, MakeData(kAccept, listen_fd_, 0));
+  return true;
+}
+
+void UringReactor::Loop() {
+  int timeout_ms = -1;  // 阻塞等待
+
+  while (!closed_) {
+    // 关闭超时连接、释放空闲连接，并以最近的过期时间作为等待的超时
+    timeout_ms = GetNextTick();
+
+    // 提交上一轮产生的请求并等待完成事件
+    int n_cqe = ring_->Wait(timeout_ms);
+    for (int i = 0; i < n_cqe; i++) {
+      uint64_t data = ring_->GetCqeData(i);
+      int res = ring_->GetCqeRes(i);
+      uint32_t flags = ring_->GetCqeFlags(i);
+      OpType op = static_cast<OpType>(data >> 56);
+
+      if (op == kAccept) {
+        DealAccept(res, flags);
+        continue;
+      }
+
+      HttpConnection* conn = GetConn(data);
+      if (!conn) {
+        // 已关闭连接的完成事件，只需归还缓冲区
+        if (flags & IORING_CQE_F_BUFFER) {
+          ring_->RecycleBuf(flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        continue;
+      }
+      FdState& state = fd_states_[conn->GetFd()];
+      if (op == kRecv && !(flags & IORING_CQE_F_MORE)) {
+        state.recv_armed = false;
+      } else if (op == kWrite) {
+        state.writing = false;
+      } else if (op == kCancel) {
+        state.n_cancel--;
+      }
+      if (state.closing) {
+        if (flags & IORING_CQE_F_BUFFER) {
+          ring_->RecycleBuf(flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        FinishClose(conn);
+        continue;
+      }
+      if (op == kRecv) {
+        DealRecv(conn, res, flags);
+      } else if (op == kWrite) {
+        DealWritev(conn, res);
+      } else if (op != kCancel) {
+        LOG_ERROR("Unexpected completion");
+      }
+    }
+  }
+}
+
+/* 取出完成事件对应的连接，连接已关闭或fd已被复用时返回nullptr */
+HttpConnection* UringReactor::GetConn(uint64_t data) {
+  int fd = static_cast<int>(data & 0xffffffff);
+  uint32_t generation = static_cast<uint32_t>(data >> 32) & kGenMask;
+  if (fd < 0 || static_cast<size_t>(fd) >= conns_->Capacity() ||
+      (conns_->GetGeneration(fd) & kGenMask) != generation) {
+    return nullptr;
+  }
+  HttpConnection* conn = conns_->Get(fd);
+  return conn->IsClosed() ? nullptr : conn;
+}
+
+void UringReactor::DealAccept(int res, uint32_t flags) {
+  if (res >= 0) {
+    int fd = res;
+    if (HttpConnection::user_count_ >= kMaxFd ||
+        static_cast<size_t>(fd) >= conns_->Capacity()) {
+      SendError(fd, "Server busy!");
+      LOG_WARN("The number of client connections exceeds the limit");
+    } else {
+      struct sockaddr_in addr = {0};
+      socklen_t len = sizeof(addr);
+      getpeername(fd, (struct sockaddr*)&addr, &len);
+      AddClient(fd, addr);
+    }
+  } else {
+    LOG_WARN("Accept error: %d", -res);
+  }
+  // multishot被内核终止时重新提交
+  if (!(flags & IORING_CQE_F_MORE)) {
+    ring_->PrepAcceptMultishot(listen_fd_, MakeData(kAccept, listen_fd_, 0));
+  }
+}
+
+/* 添加新客户，提交multishot recv */
+void UringReactor::AddClient(int fd, sockaddr_in addr) {
+  assert(fd > 0);
+  conns_->Acquire(fd);
+  HttpConnection* conn = conns_->Get(fd);
+  conn->Init(fd, addr);
+  idle_timer_->Remove(fd);
+  if (timeout_ms_ > 0) {
+    timer_->Add(fd, timeout_ms_,
+                std::bind(&UringReactor::CloseConnection, this, conn));
+  }
+  fd_states_[fd] = FdState{false, false, false, false, 0};
+  ArmRecv(fd);
+  LOG_INFO("Client[%d] connected.", conn->GetFd());
+}
+
+/* 先取消fd上未完成的recv/writev，等取消和这些请求的完成事件都返回后再关闭，
+内核可能还在读写连接的缓冲区和文件映射，提前归还会被其他连接复用
+*/
+void UringReactor::CloseConnection(HttpConnection* conn) {
+  assert(conn);
+  int fd = conn->GetFd();
+  FdState& state = fd_states_[fd];
+  if (conn->IsClosed() || state.closing) {
+    return;
+  }
+  LOG_INFO("Client[%d] quit!", fd);
+  timer_->Remove(fd);
+  idle_timer_->Remove(fd);
+  state.closing = true;
+  state.n_cancel++;
+  ring_->PrepCancelFd(fd, MakeData(kCancel, fd, conns_->GetGeneration(fd)));
+}
+
+/* 内核不再持有连接的任何请求时才真正关闭 */
+void UringReactor::FinishClose(HttpConnection* conn) {
+  const FdState& state = fd_states_[conn->GetFd()];
+  if (state.recv_armed || state.writing || state.n_cancel > 0) {
+    return;
+  }
+  conn->Close();
+}
+
+void UringReactor::DealRecv(HttpConnection* conn, int res, uint32_t flags) {
+  int fd = conn->GetFd();
+  FdState& state = fd_states_[fd];
+  if (res > 0) {
+    // 拷贝到读缓冲区后立即归还缓冲区
+    uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    conn->AppendReadBuffer(ring_->GetBuf(bid), res);
+    ring_->RecycleBuf(bid);
+    ExtentTime(conn);
+    // 上一个响应还没写完时先留在读缓冲区，写完后再处理
+    if (conn->ToWriteBytes() == 0) {
+      Send(conn);
+    }
+    if (conn->GetReadBytes() >= kRecvHighWater) {
+      PauseRecv(fd);
+    }
+  } else if (res != -ENOBUFS && res != -ECANCELED) {
+    // 0表示对端关闭，其余为出错；ENOBUFS只是缓冲区暂时用完，重新提交即可；
+    // ECANCELED是暂停接收时取消的
+    CloseConnection(conn);
+    return;
+  }
+  if (!state.recv_armed && !state.recv_paused) {
+    ArmRecv(fd);
+  }
+}
+
+void UringReactor::ArmRecv(int fd) {
+  fd_states_[fd].recv_armed = true;
+  ring_->PrepRecvMultishot(fd, kBufGroup,
+                           MakeData(kRecv, fd, conns_->GetGeneration(fd)));
+}
+
+/* 取消multishot recv，已经产生的完成事件照常处理 */
+void UringReactor::PauseRecv(int fd) {
+  FdState& state = fd_states_[fd];
+  if (state.recv_paused) {
+    return;
+  }
+  state.recv_paused = true;
+  if (state.recv_armed) {
+    state.n_cancel++;
+    uint32_t generation = conns_->GetGeneration(fd);
+    ring_->PrepCancel(MakeData(kRecv, fd, generation),
+                      MakeData(kCancel, fd, generation));
+  }
+}
+
+/* 读缓冲区降到高水位以下，或者已经没有响应要等待时恢复接收 */
+void UringReactor::ResumeRecv(HttpConnection* conn) {
+  int fd = conn->GetFd();
+  FdState& state = fd_states_[fd];
+  if (!state.recv_paused || (conn->GetReadBytes() >= kRecvHighWater &&
+                             conn->ToWriteBytes() > 0)) {
+    return;
+  }
+  state.recv_paused = false;
+  // 取消还没完成时等它的完成事件到达后在DealRecv中重新提交
+  if (!state.recv_armed) {
+    ArmRecv(fd);
+  }
+}
+
+void UringReactor::DealWritev(HttpConnection* conn, int res) {
+  if (res < 0 && res != -EAGAIN && res != -EINTR) {
+    CloseConnection(conn);
+    return;
+  }
+  if (res > 0) {
+    conn->AdvanceIov(res);
+  }
+  // 没写完，继续提交剩余部分
+  if (conn->ToWriteBytes() > 0) {
+    SubmitWrite(conn);
+    return;
+  }
+  // 传输完成
+  if (!conn->IsKeepAlive()) {
+    CloseConnection(conn);
+    return;
+  }
+  ExtentTime(conn);
+  // 处理写期间已收到的请求
+  Send(conn);
+  ResumeRecv(conn);
+}
+
+/* 解析请求并提交响应 */
+void UringReactor::Send(HttpConnection* conn) {
+  if (conn->Process()) {
+    SubmitWrite(conn);
+  }
+}
+
+/* 这一批响应的头和内容都在iov中，作为一个writev提交 */
+void UringReactor::SubmitWrite(HttpConnection* conn) {
+  int fd = conn->GetFd();
+  fd_states_[fd].writing = true;
+  ring_->PrepWritev(fd, conn->GetIov(), conn->GetIovCnt(),
+                    MakeData(kWrite, fd, conns_->GetGeneration(fd)));
+}
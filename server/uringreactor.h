@@ -0,0 +1,75 @@
+#ifndef URINGREACTOR_H
+#define URINGREACTOR_H
+
+#include "../utils/uring.h"
+#include "reactor.h"
+
+/* 基于io_uring的反应堆，与Reactor承担相同的角色
+multishot accept持续接受连接，multishot recv由内核从provided buffer中选取缓冲区，
+响应头和文件内容用一个writev提交，提交与等待合并为一次io_uring_enter。
+不把头和内容拆成IOSQE_IO_LINK链接的两个请求：一个writev已经保证了顺序，
+而套接字上头只写出一部分时，链接的下一个请求会以-ECANCELED失败，
+反而要多处理一个完成事件并重新提交。
+稳态下每个请求不再需要epoll_wait + readv + writev + epoll_ctl四次系统调用
+读、解析、写都在反应堆线程中完成，不使用线程池
+*/
+class UringReactor : public Reactor {
+ public:
+  UringReactor(int listen_fd, int timeout_ms, ConnPool* conns);
+  ~UringReactor() = default;
+
+  bool Init() override;
+  void Loop() override;
+
+ protected:
+  void CloseConnection(HttpConnection* conn) override;
+  void AddClient(int fd, sockaddr_in addr) override;
+
+ private:
+  // user_data: 高8位操作类型，中间24位generation，低32位fd
+  enum OpType {
+    kAccept = 1,
+    kRecv,
+    kWrite,
+    kCancel,
+  };
+  static const uint32_t kGenMask = 0xffffff;
+  static const uint16_t kBufGroup = 0;
+  static const unsigned kBufCount = 1024;
+  static const unsigned kBufSize = 4096;
+  /* 读缓冲区中未处理的数据达到该值时暂停接收(取消multishot recv)，
+  响应写完、数据被处理后再重新提交；对端只发不收时内存不会无限增长
+  */
+  static const size_t kRecvHighWater = 256 * 1024;
+
+  /* 每个fd上提交给内核的请求，按fd索引 */
+  struct FdState {
+    bool recv_armed;   // multishot recv还在内核中
+    bool recv_paused;  // 超过高水位，暂停接收
+    bool writing;      // writev还没有完成
+    bool closing;      // 已提交取消，等请求全部返回后关闭
+    int n_cancel;      // 还没返回的取消请求
+  };
+
+  static inline uint64_t MakeData(OpType op, int fd, uint32_t generation) {
+    return (static_cast<uint64_t>(op) << 56) |
+           (static_cast<uint64_t>(generation & kGenMask) << 32) |
+           static_cast<uint32_t>(fd);
+  }
+
+  HttpConnection* GetConn(uint64_t data);
+  void DealAccept(int res, uint32_t flags);
+  void DealRecv(HttpConnection* conn, int res, uint32_t flags);
+  void DealWritev(HttpConnection* conn, int res);
+  void Send(HttpConnection* conn);
+  void SubmitWrite(HttpConnection* conn);
+  void FinishClose(HttpConnection* conn);
+  void ArmRecv(int fd);
+  void PauseRecv(int fd);
+  void ResumeRecv(HttpConnection* conn);
+
+  std::unique_ptr<IoUring> ring_;
+  std::vector<FdState> fd_states_;
+};
+
+#endif
\ No newline at end of file
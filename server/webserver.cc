@@ -1,13 +1,26 @@
 #include "webserver.h"
 
 WebServer::WebServer(char* base_dir, int port, int trig_mode, int timeout_ms, bool use_linger,
-                     int n_thread, bool log, int log_level, int log_queue_size)
+                     int n_thread, bool log, int log_level, int log_queue_size,
+                     int n_reactor, int max_conn, bool use_io_uring,
+                     int backlog, int defer_accept_s, bool use_sendfile,
+                     int file_cache_mb, int keep_alive_max,
+                     const char* sql_host, int sql_port, const char* sql_user,
+                     const char* sql_pwd, const char* db_name,
+                     int sql_conn_num)
     : port_(port),
       timeout_ms_(timeout_ms),
+      n_reactor_(n_reactor),
+      max_conn_(max_conn),
+      use_io_uring_(use_io_uring),
+      backlog_(backlog),
+      defer_accept_s_(defer_accept_s),
+      use_sendfile_(use_sendfile),
+      file_cache_mb_(file_cache_mb),
+      keep_alive_max_(keep_alive_max),
+      sql_conn_num_(sql_host ? sql_conn_num : 0),
       use_linger_(use_linger),
-      closed_(false),
-      threadpool_(new ThreadPool(n_thread)),
-      epoller_(new Epoller())
+      closed_(false)
        {
   // maybe memory leak
   // resources_dir_ = getcwd(nullptr, 256);
@@ -17,6 +30,8 @@ WebServer::WebServer(char* base_dir, int port, int trig_mode, int timeout_ms, bo
 
   HttpConnection::user_count_ = 0;
   HttpConnection::resources_dir_ = resources_dir_;
+  HttpResponse::keep_alive_max_ = keep_alive_max_;
+  HttpResponse::keep_alive_timeout_s_ = timeout_ms_ / 1000;
 
   if (log) {
     Log::Instance()->Init(log_level, "./log", ".log", log_queue_size);
@@ -24,18 +39,37 @@ WebServer::WebServer(char* base_dir, int port, int trig_mode, int timeout_ms, bo
 
   InitEventType(trig_mode);
 
-  if (!InitListenSocket()) {
+  /* io_uring后端的多发接收会覆盖读缓冲区，请求等待查询时不能暂停接收，改用epoll */
+  if (sql_conn_num_ > 0 && use_io_uring_) {
+    LOG_WARN("io_uring backend does not support sql, fall back to epoll");
+    use_io_uring_ = false;
+  }
+  if (!InitReactors(n_thread) ||
+      (sql_conn_num_ > 0 &&
+       !InitSql(sql_host, sql_port, sql_user, sql_pwd, db_name))) {
     closed_ = true;
   }
+  // io_uring后端通过writev提交iov，不支持sendfile
+  HttpConnection::use_sendfile_ = use_sendfile_ && !use_io_uring_;
+  // 后端确定后才知道是否使用sendfile，sendfile模式下文件不需要映射
+  FileCache::Instance()->Init(static_cast<size_t>(file_cache_mb_) << 20,
+                              resources_dir_, !HttpConnection::use_sendfile_);
 
   if (closed_) {
     LOG_ERROR("========== Server init error!==========");
   } else {
     LOG_INFO("========== Server init ==========");
+    LOG_INFO("Request scanner: %s", Scanner::GetImplName());
   }
 }
 
-WebServer::~WebServer() {}
+WebServer::~WebServer() {
+  if (sql_conn_num_ > 0) {
+    // 反应堆析构时才关闭数据库连接
+    reactors_.clear();
+    mysql_library_end();
+  }
+}
 
 void WebServer::InitEventType(int mode) {
   listen_event_type_ = EPOLLRDHUP;
@@ -62,169 +96,94 @@ void WebServer::InitEventType(int mode) {
 }
 
 void WebServer::Start() {
-  int timeout_ms = -1;  // 阻塞等待
-
-  if (!closed_) {
-    LOG_INFO("server started.");
+  if (closed_) {
+    return;
   }
+  LOG_INFO("server started.");
 
-  // 事件监听循环
-  while (!closed_) {
-    /* 定时器占位
-     */
-
-    // 获取时间数
-    int n_event = epoller_->Wait(timeout_ms);
-    // 处理就绪事件
-    for (int i = 0; i < n_event; i++) {
-      // 获取事件的fd和type
-      int fd = epoller_->GetEventFd(i);
-      uint32_t events_type = epoller_->GetEventsType(i);
-
-      // 判断每个类型属于什么类型
-      if (fd == listen_fd_) {  // 有新用户连接
-        DealListen();
-      } else if (events_type &
-                 (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {  // 异常事件
-        // 处理异常并关闭连接
-        assert(connections_.count(fd) > 0);
-        DealException(&connections_[fd]);
-      } else if (events_type & EPOLLIN) {
-        // 处理请求
-        assert(connections_.count(fd) > 0);
-        DealRead(&connections_[fd]);
-      } else if (events_type & EPOLLOUT) {
-        // 处理响应
-        assert(connections_.count(fd) > 0);
-        DealWrite(&connections_[fd]);
-      } else {
-        LOG_ERROR("Unexpected event");
-      }
-    }
+  // 其余反应堆各占一个线程，第一个反应堆在主线程运行
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < reactors_.size(); i++) {
+    threads.emplace_back(&Reactor::Loop, reactors_[i].get());
   }
-}
-
-void WebServer::CloseConnection(HttpConnection *conn) {
-  assert(conn);
-  LOG_INFO("Client[%d] quit!", conn->GetFd());
-  // 删除对应的文件描述符
-  epoller_->DelFd(conn->GetFd());
-  // 清理其他连接信息
-  conn->Close();
-}
-
-void WebServer::DealException(HttpConnection *conn) { CloseConnection(conn); }
-
-/* 处理用户新请求 */
-void WebServer::DealListen() {
-  struct sockaddr_in addr;
-  socklen_t len = sizeof(addr);
-  do {
-    int fd = accept(listen_fd_, (struct sockaddr *)&addr, &len);
-    // 连接失败
-    if (fd <= 0) {
-      return;
-    } else if (HttpConnection::user_count_ >= kMaxFd) {  // 超过最大连接数
-      SendError(fd, "Server busy!");
-      LOG_WARN("The number of client connections exceeds the limit");
-      return;
-    }
-    AddClient(fd, addr);
-  } while (listen_event_type_ && EPOLLET);  // 边缘模式需要一次性处理完
-}
-
-/* 给客户发送错误信息 */
-void WebServer::SendError(int fd, const char *info) {
-  assert(fd > 0);
-  int ret = send(fd, info, strlen(info), 0);
-  if (ret < 0) {
-    LOG_WARN("Failed to send error to client[%d] ", fd);
+  reactors_[0]->Loop();
+  for (auto& t : threads) {
+    t.join();
   }
-  close(fd);
-}
-
-/* 添加新客户 */
-void WebServer::AddClient(int fd, sockaddr_in addr) {
-  assert(fd > 0);
-  // 初始化
-  connections_[fd].Init(fd, addr);
-  /*
-  定时器占位
-  */
-  // EPOLLIN指示可读时触发事件，可读意味着客户发来了新请求
-  epoller_->AddFd(fd, EPOLLIN | conn_event_type_);
-  SetSocketNonBlocking(fd);
-  LOG_INFO("Client[%d] connected.", connections_[fd].GetFd());
 }
 
-/* 默认情况下socket是blocking的，等待accept、recv、send、connect一系列函数执行完才能返回
-可使用fcntl函数将socket设置为非阻塞，这样函数就可以立即返回了，不用等待满足条件才返回，提高并发效率
-F_SETFD：设置文件描述词标志
-F_GETFD：读取文件描述词标志。
-F_GETFL：读取文件状态标志
-F_SETFL：设置文件状态标志
-这几个参数的区别仍不太了解
-*/
-int WebServer::SetSocketNonBlocking(int fd) {
-  assert(fd > 0);
-  // return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
-  // 据说这才是正确用法，但两种结果都一样
-  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
-}
-
-void WebServer::read(HttpConnection *conn) {
-  assert(conn);
-  int ret = -1;
-  int read_errno = 0;
-  ret = conn->read(&read_errno);
-  // 没能读取到数据，关闭连接
-  if (ret <= 0 && read_errno != EAGAIN) {
-    CloseConnection(conn);
-    return;
+/* 创建反应堆，多反应堆模式下每个反应堆都有自己的监听套接字 */
+bool WebServer::InitReactors(int n_thread) {
+  int n = n_reactor_ > 0 ? n_reactor_ : 1;
+  if (n_reactor_ <= 0 && !use_io_uring_) {
+    threadpool_.reset(new ThreadPool(n_thread));
   }
-  ModClientFdEvent(conn);
-}
-
-void WebServer::write(HttpConnection *conn) {
-  assert(conn);
-  int ret = -1;
-  int write_errno = 0;
-  ret = conn->write(&write_errno);
-  // 传输完成
-  if (conn->ToWriteBytes() == 0) {
-    if (conn->IsKeepAlive()) {
-      ModClientFdEvent(conn);
-      return;
+  conns_.reset(new ConnPool(max_conn_));
+  if (!conns_->Init()) {
+    return false;
+  }
+  for (int i = 0; i < n; i++) {
+    int listen_fd = InitListenSocket(n_reactor_ > 0);
+    if (listen_fd < 0) {
+      return false;
     }
-  } else if (ret < 0) {
-    // 继续传输
-    if (write_errno == EAGAIN) {
-      epoller_->ModFd(conn->GetFd(), conn_event_type_ | EPOLLOUT);
-      return;
+    std::unique_ptr<Reactor> reactor;
+    if (use_io_uring_) {
+      reactor.reset(new UringReactor(listen_fd, timeout_ms_, conns_.get()));
+      if (!reactor->Init()) {
+        // 内核不支持，关闭监听套接字后改用epoll重新创建
+        LOG_WARN("io_uring unavailable, fall back to epoll");
+        use_io_uring_ = false;
+        reactor.reset();
+        listen_fd = InitListenSocket(n_reactor_ > 0);
+        if (listen_fd < 0) {
+          return false;
+        }
+      }
     }
+    if (!reactor) {
+      reactor.reset(new Reactor(listen_fd, listen_event_type_,
+                                conn_event_type_, timeout_ms_, conns_.get(),
+                                threadpool_.get()));
+      if (!reactor->Init()) {
+        return false;
+      }
+    }
+    reactors_.push_back(std::move(reactor));
   }
-  CloseConnection(conn);
-}
-
-void WebServer::DealRead(HttpConnection *conn) {
-  /* 定时器占位
-   */
-  threadpool_->AddTask(std::bind(&WebServer::read, this, conn));
+  LOG_INFO("Reactor num: %d, backend: %s, thread pool: %s, max conn: %d, sendfile: %s", n,
+           use_io_uring_ ? "io_uring" : "epoll", threadpool_ ? "on" : "off",
+           max_conn_, use_sendfile_ && !use_io_uring_ ? "on" : "off");
+  return true;
 }
 
-void WebServer::DealWrite(HttpConnection *conn) {
-  /* 定时器占位
-   */
-  threadpool_->AddTask(std::bind(&WebServer::write, this, conn));
+/* 每个反应堆一个数据库连接池，查询和回调都在反应堆线程中完成 */
+bool WebServer::InitSql(const char* host, int port, const char* user,
+                        const char* pwd, const char* db_name) {
+  // 多线程使用前先初始化客户端库
+  if (mysql_library_init(0, nullptr, nullptr)) {
+    LOG_ERROR("MySQL library init error!");
+    return false;
+  }
+  for (auto& reactor : reactors_) {
+    if (!reactor->InitSql(host, port, user, pwd, db_name, sql_conn_num_)) {
+      return false;
+    }
+  }
+  HttpConnection::use_sql_ = true;
+  LOG_INFO("Sql: %s:%d, db: %s, conn num per reactor: %d", host, port, db_name,
+           sql_conn_num_);
+  return true;
 }
 
-bool WebServer::InitListenSocket() {
+int WebServer::InitListenSocket(bool reuse_port) {
   int ret;
+  int listen_fd;
   struct sockaddr_in addr;
 
   if (port_ > 65535 || port_ < 1024) {
     LOG_ERROR("Port:%d error!", port_);
-    return false;
+    return -1;
   }
 
   addr.sin_family = AF_INET;
@@ -239,60 +198,66 @@ bool WebServer::InitListenSocket() {
     optLinger.l_linger = 1;
   }
 
-  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-  if (listen_fd_ < 0) {
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
     LOG_ERROR("Create socket error!", port_);
-    return false;
+    return -1;
   }
 
-  ret = setsockopt(listen_fd_, SOL_SOCKET, SO_LINGER, &optLinger,
+  ret = setsockopt(listen_fd, SOL_SOCKET, SO_LINGER, &optLinger,
                    sizeof(optLinger));
   if (ret < 0) {
-    close(listen_fd_);
+    close(listen_fd);
     LOG_ERROR("Init linger error!", port_);
-    return false;
+    return -1;
   }
 
   int optval = 1;
   /* 端口复用 */
   /* 只有最后一个套接字会正常接收数据。 */
-  ret = setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
+  ret = setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
                    sizeof(int));
   if (ret == -1) {
     LOG_ERROR("set socket setsockopt error !");
-    close(listen_fd_);
-    return false;
+    close(listen_fd);
+    return -1;
   }
 
-  ret = bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr));
+  /* 多反应堆模式：每个反应堆绑定同一端口，由内核按连接哈希分发 */
+  if (reuse_port) {
+    ret = setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT,
+                     (const void *)&optval, sizeof(int));
+    if (ret == -1) {
+      LOG_ERROR("set SO_REUSEPORT error !");
+      close(listen_fd);
+      return -1;
+    }
+  }
+
+  /* 三次握手完成后等到客户端发来数据才放入accept队列，
+  只连接不发数据的客户端不会占用连接和定时器 */
+  if (defer_accept_s_ > 0) {
+    ret = setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                     (const void *)&defer_accept_s_, sizeof(int));
+    if (ret == -1) {
+      LOG_WARN("set TCP_DEFER_ACCEPT error !");
+    }
+  }
+
+  ret = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
   if (ret < 0) {
     LOG_ERROR("Bind Port:%d error!", port_);
-    close(listen_fd_);
-    return false;
+    close(listen_fd);
+    return -1;
   }
 
-  ret = listen(listen_fd_, 6);
+  ret = listen(listen_fd, backlog_);
   if (ret < 0) {
     LOG_ERROR("Listen port:%d error!", port_);
-    close(listen_fd_);
-    return false;
-  }
-  ret = epoller_->AddFd(listen_fd_, listen_event_type_ | EPOLLIN);
-  if (ret == 0) {
-    LOG_ERROR("Add listen error!");
-    close(listen_fd_);
-    return false;
-  }
-  SetSocketNonBlocking(listen_fd_);
-  LOG_INFO("Server port:%d", port_);
-  return true;
-}
-
-/* 修改客户描述符事件类型 */
-void WebServer::ModClientFdEvent(HttpConnection *conn) {
-  if (conn->Process()) {
-    epoller_->ModFd(conn->GetFd(), conn_event_type_ | EPOLLOUT);
-  } else {
-    epoller_->ModFd(conn->GetFd(), conn_event_type_ | EPOLLIN);
+    close(listen_fd);
+    return -1;
   }
+  Reactor::SetSocketNonBlocking(listen_fd);
+  LOG_INFO("Server port:%d, backlog:%d", port_, backlog_);
+  return listen_fd;
 }
\ No newline at end of file
@@ -2,49 +2,81 @@
 #define WEBSERVER_H
 
 #include <fcntl.h>
+#include <netinet/tcp.h>
 
-#include <functional>
-#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "../http/connection.h"
 #include "../log/logger.h"
+#include "../pool/connpool.h"
 #include "../pool/threadpool.h"
-#include "../utils/epoller.h"
+#include "../utils/filecache.h"
+#include "reactor.h"
+#include "uringreactor.h"
 
 class WebServer {
  private:
   bool closed_;
   bool use_linger_;
-  int listen_fd_;
-  static const int kMaxFd = 65536;
   int port_;
   int timeout_ms_;
+  // 反应堆个数，0表示单反应堆+线程池
+  int n_reactor_;
+  // 连接表容量，即可接受的最大fd
+  int max_conn_;
+  // 使用io_uring后端代替epoll
+  bool use_io_uring_;
+  // listen的backlog
+  int backlog_;
+  // TCP_DEFER_ACCEPT秒数，0表示不启用
+  int defer_accept_s_;
+  // 静态文件用sendfile发送
+  bool use_sendfile_;
+  // 静态文件缓存上限(MB)，0表示不缓存
+  int file_cache_mb_;
+  // 单个持久连接最多处理的请求数
+  int keep_alive_max_;
+  // 每个反应堆的数据库连接数，0表示不连接数据库，登录、注册直接通过
+  int sql_conn_num_;
   char resources_dir_[128];
 
  private:
   uint32_t listen_event_type_, conn_event_type_;
-  std::unique_ptr<Epoller> epoller_;
   std::unique_ptr<ThreadPool> threadpool_;
-  std::unordered_map<int, HttpConnection> connections_;
+  // 须在reactors_之前声明，保证反应堆先于连接表析构
+  std::unique_ptr<ConnPool> conns_;
+  std::vector<std::unique_ptr<Reactor>> reactors_;
 
  private:
-  void DealRead(HttpConnection *conn);
-  void read(HttpConnection *conn);
-  void write(HttpConnection *conn);
-  void DealWrite(HttpConnection *conn);
-  void DealException(HttpConnection *conn);
-  void CloseConnection(HttpConnection *conn);
-  void SendError(int fd, const char *info);
-  void AddClient(int fd, sockaddr_in addr);
-  void ModClientFdEvent(HttpConnection *conn);
-  void DealListen();
   void InitEventType(int mode);
-  int SetSocketNonBlocking(int fd);
-  bool InitListenSocket();
+  int InitListenSocket(bool reuse_port);
+  bool InitReactors(int n_thread);
+  bool InitSql(const char* host, int port, const char* user, const char* pwd,
+               const char* db_name);
 
  public:
+  /* n_reactor > 0 时开启 one loop per thread 模式：
+  每个反应堆线程拥有自己的Epoller、SO_REUSEPORT监听套接字和连接，n_thread被忽略
+  max_conn为连接表槽位数，启动时一次性分配
+  use_io_uring为true时每个反应堆使用io_uring后端(不使用线程池)，内核不支持时退回epoll
+  defer_accept_s > 0 时开启TCP_DEFER_ACCEPT，连接收到数据后才会被accept
+  use_sendfile为true时文件内容用sendfile零拷贝发送，io_uring后端下不生效
+  file_cache_mb为进程内共享的静态文件缓存上限，0表示每次请求都重新打开文件
+  keep_alive_max为单个持久连接最多处理的请求数，持久连接的空闲上限即timeout_ms
+  sql_conn_num > 0 时每个反应堆建立sql_conn_num个非阻塞的数据库连接验证登录、注册，
+  需要MariaDB Connector/C；此时不使用io_uring后端
+  */
   WebServer(char* base_dir, int port, int trig_mode, int timeout_ms, bool use_linger_,
-            int n_thread, bool log, int log_level, int log_queue_size);
+            int n_thread, bool log, int log_level, int log_queue_size,
+            int n_reactor = 0, int max_conn = Reactor::kMaxFd,
+            bool use_io_uring = false, int backlog = 1024,
+            int defer_accept_s = 5, bool use_sendfile = false,
+            int file_cache_mb = 64, int keep_alive_max = 100,
+            const char* sql_host = nullptr, int sql_port = 3306,
+            const char* sql_user = "", const char* sql_pwd = "",
+            const char* db_name = "", int sql_conn_num = 0);
 
   ~WebServer();
   void Start();
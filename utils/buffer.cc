@@ -1,15 +1,20 @@
 #include "buffer.h"
 
+Buffer::Buffer(size_t size) : capacity_(0), read_pos_(0), write_pos_(0) {
+  buffer_ = size > 0 ? Allocate(size, &capacity_) : nullptr;
+}
+
 /* 读取用户发来的消息 */
 ssize_t Buffer::ReadFd(int fd, int* __errno) {
-  char buff[65535];
+  // 每个线程一块，只在readv期间使用，空闲连接不需要为突发的大请求预留空间
+  static thread_local char extra[kExtraSize];
   struct iovec iov[2];
   const size_t writable = GetWritableBytes();
   /* 分散读， 保证数据全部读完 */
   iov[0].iov_base = begin() + write_pos_;
   iov[0].iov_len = writable;
-  iov[1].iov_base = buff;
-  iov[1].iov_len = sizeof(buff);
+  iov[1].iov_base = extra;
+  iov[1].iov_len = sizeof(extra);
 
   const ssize_t len = readv(fd, iov, 2);
   if (len < 0) {
@@ -17,8 +22,8 @@ ssize_t Buffer::ReadFd(int fd, int* __errno) {
   } else if (static_cast<size_t>(len) <= writable) {
     write_pos_ += len;
   } else {
-    write_pos_ = buffer_.size();
-    Append(buff, len - writable);
+    write_pos_ = capacity_;
+    Append(extra, len - writable);
   }
   return len;
 }
@@ -30,16 +35,24 @@ void Buffer::Append(const char* str, size_t len) {
   MoveWritePos(len);
 }
 
+/* 空间不够时换一块更大的存储，否则把未读数据移到开头 */
 void Buffer::Resize(size_t size) {
+  size_t readable = GetReadableBytes();
   if (GetWritableBytes() + read_pos_ < size) {
-    buffer_.resize(write_pos_ + size + 1);
+    size_t capacity;
+    char* buffer = Allocate(std::max(readable + size, capacity_ * 2), &capacity);
+    if (readable > 0) {
+      memcpy(buffer, begin() + read_pos_, readable);
+    }
+    Deallocate(buffer_, capacity_);
+    buffer_ = buffer;
+    capacity_ = capacity;
   } else {
-    size_t readable = GetReadableBytes();
-    std::copy(begin() + read_pos_, begin() + write_pos_, begin());
-    read_pos_ = 0;
-    write_pos_ = read_pos_ + readable;
-    assert(readable == GetReadableBytes());
+    memmove(begin(), begin() + read_pos_, readable);
   }
+  read_pos_ = 0;
+  write_pos_ = readable;
+  assert(readable == GetReadableBytes());
 }
 
 void Buffer::EnsureWriteable(size_t len) {
@@ -49,8 +62,36 @@ void Buffer::EnsureWriteable(size_t len) {
   assert(GetWritableBytes() >= len);
 }
 
+void Buffer::Release() {
+  assert(GetReadableBytes() == 0);
+  Deallocate(buffer_, capacity_);
+  buffer_ = nullptr;
+  capacity_ = 0;
+  Reset();
+}
+
+char* Buffer::Allocate(size_t size, size_t* capacity) {
+  if (size <= ChunkPool::kChunkSize) {
+    *capacity = ChunkPool::kChunkSize;
+    return ChunkPool::Alloc();
+  }
+  *capacity = size;
+  return new char[size];
+}
+
+void Buffer::Deallocate(char* buffer, size_t capacity) {
+  if (!buffer) {
+    return;
+  }
+  if (capacity == ChunkPool::kChunkSize) {
+    ChunkPool::Free(buffer);
+  } else {
+    delete[] buffer;
+  }
+}
+
 string Buffer::RetrieveAllToStr() {
     std::string str(NextReadable(), GetReadableBytes());
     Reset();
     return str;
-}
\ No newline at end of file
+}
@@ -5,25 +5,31 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
-#include <atomic>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
-#include <vector>
+#include <string>
+
+#include "chunkpool.h"
 
 using std::string;
 
+/* 连续存放的缓冲区
+不超过一个块的存储从ChunkPool取，更大时直接分配；扩容时顺便把未读数据移到开头。
+Release把存储还回去，关闭的连接的缓冲区只剩对象本身，下次写入时再分配
+*/
 class Buffer {
  public:
   /* 初始化缓冲区大小，默认1024， */
-  Buffer(size_t size = 1024) : buffer_(size), read_pos_(0), write_pos_(0) {}
-  ~Buffer() = default;
+  Buffer(size_t size = 1024);
+  ~Buffer() { Deallocate(buffer_, capacity_); }
+  Buffer(const Buffer&) = delete;
+  Buffer& operator=(const Buffer&) = delete;
 
   string RetrieveAllToStr();
 
   /* 计算可写空间 */
-  inline size_t GetWritableBytes() const {
-    return buffer_.size() - write_pos_;
-  };
+  inline size_t GetWritableBytes() const { return capacity_ - write_pos_; };
 
   /* 计算可读空间 */
   inline size_t GetReadableBytes() const { return write_pos_ - read_pos_; };
@@ -52,25 +58,35 @@ class Buffer {
     read_pos_ += (target - NextReadable());
   }
 
+  /* 只重置位置，不需要清零内容 */
   void Reset() {
-    bzero(&buffer_[0], buffer_.size());
     read_pos_ = 0;
     write_pos_ = 0;
   }
+  /* 归还存储，缓冲区中不能还有未读数据 */
+  void Release();
+  inline size_t GetCapacity() const { return capacity_; }
   ssize_t ReadFd(int fd, int* __errno);
   void Append(const char* str, size_t len);
   void Append(const string& str) { Append(str.data(), str.length()); }
 
+  // ReadFd一次最多读入的字节数，超出现有空间的部分先读到线程的公共区域
+  static const size_t kExtraSize = 65536;
+
  private:
   /* 获取首指针 */
-  inline char* begin() { return &*buffer_.begin(); }
-  inline const char* begin() const { return &*buffer_.begin(); }
+  inline char* begin() { return buffer_; }
+  inline const char* begin() const { return buffer_; }
   void Resize(size_t size);
   void EnsureWriteable(size_t len);
-
-  std::vector<char> buffer_;
-  std::atomic<std::size_t> write_pos_;
-  std::atomic<std::size_t> read_pos_;
+  static char* Allocate(size_t size, size_t* capacity);
+  static void Deallocate(char* buffer, size_t capacity);
+
+  char* buffer_;
+  size_t capacity_;
+  // 同一时刻只有一个线程使用缓冲区，位置不需要原子操作
+  std::size_t read_pos_;
+  std::size_t write_pos_;
 };
 
-#endif
\ No newline at end of file
+#endif
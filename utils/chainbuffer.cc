@@ -0,0 +1,76 @@
+#include "chainbuffer.h"
+
+void ChainBuffer::Append(const char* data, size_t len) {
+  assert(data || len == 0);
+  const size_t kSize = ChunkPool::kChunkSize;
+  while (len > 0) {
+    size_t idx = write_pos_ / kSize;
+    if (idx == chunks_.size()) {
+      chunks_.push_back(ChunkPool::Alloc());
+    }
+    size_t offset = write_pos_ % kSize;
+    size_t n = std::min(len, kSize - offset);
+    memcpy(chunks_[idx] + offset, data, n);
+    data += n;
+    len -= n;
+    write_pos_ += n;
+  }
+}
+
+int ChainBuffer::GetIov(size_t begin, size_t end, struct iovec* iov,
+                        int max) const {
+  assert(begin <= end && end <= GetReadableBytes());
+  const size_t kSize = ChunkPool::kChunkSize;
+  begin += read_pos_;
+  end += read_pos_;
+  int n = 0;
+  while (begin < end) {
+    assert(n < max);
+    size_t offset = begin % kSize;
+    size_t len = std::min(end - begin, kSize - offset);
+    iov[n].iov_base = chunks_[begin / kSize] + offset;
+    iov[n].iov_len = len;
+    n++;
+    begin += len;
+  }
+  return n;
+}
+
+void ChainBuffer::Retrieve(size_t len) {
+  assert(len <= GetReadableBytes());
+  read_pos_ += len;
+  if (read_pos_ == write_pos_) {
+    Reset();
+  }
+}
+
+std::string ChainBuffer::RetrieveAllToStr() {
+  std::string str;
+  str.reserve(GetReadableBytes());
+  const size_t kSize = ChunkPool::kChunkSize;
+  for (size_t pos = read_pos_; pos < write_pos_;) {
+    size_t offset = pos % kSize;
+    size_t len = std::min(write_pos_ - pos, kSize - offset);
+    str.append(chunks_[pos / kSize] + offset, len);
+    pos += len;
+  }
+  Reset();
+  return str;
+}
+
+void ChainBuffer::Trim(size_t max_chunks) {
+  assert(GetReadableBytes() == 0);
+  while (chunks_.size() > max_chunks) {
+    ChunkPool::Free(chunks_.back());
+    chunks_.pop_back();
+  }
+  Reset();
+}
+
+void ChainBuffer::Release() {
+  for (char* chunk : chunks_) {
+    ChunkPool::Free(chunk);
+  }
+  chunks_.clear();
+  Reset();
+}
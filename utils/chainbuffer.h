@@ -0,0 +1,55 @@
+#ifndef CHAINBUFFER_H
+#define CHAINBUFFER_H
+
+#include <assert.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "chunkpool.h"
+
+/* 由固定大小的块串成的缓冲区
+追加时写满一块再取下一块，已写入的数据不会移动，指向其中的指针在Reset前一直有效，
+不需要扩容拷贝；数据以iovec链的形式交给writev。
+Reset只重置位置，已有的块留着下次使用，Release才把块还给块池，
+Trim只归还超出的块
+*/
+class ChainBuffer {
+ public:
+  ChainBuffer() : read_pos_(0), write_pos_(0) {}
+  ~ChainBuffer() { Release(); }
+  ChainBuffer(const ChainBuffer&) = delete;
+  ChainBuffer& operator=(const ChainBuffer&) = delete;
+
+  void Append(const char* data, size_t len);
+  void Append(const std::string& str) { Append(str.data(), str.size()); }
+
+  inline size_t GetReadableBytes() const { return write_pos_ - read_pos_; }
+
+  /* 把可读部分中[begin, end)(相对可读开头)填入iov，每块一项，返回项数 */
+  int GetIov(size_t begin, size_t end, struct iovec* iov, int max) const;
+  /* 已写入数据所占的块数，用于估计GetIov需要的项数 */
+  inline int GetUsedChunks() const {
+    return (write_pos_ + ChunkPool::kChunkSize - 1) / ChunkPool::kChunkSize;
+  }
+
+  /* 丢弃开头len字节，全部读完时自动Reset */
+  void Retrieve(size_t len);
+  std::string RetrieveAllToStr();
+
+  inline void Reset() { read_pos_ = write_pos_ = 0; }
+  void Release();
+  /* 缓冲区为空时调用，最多保留max_chunks块 */
+  void Trim(size_t max_chunks);
+
+ private:
+  std::vector<char*> chunks_;
+  // 相对第一块开头的位置
+  size_t read_pos_;
+  size_t write_pos_;
+};
+
+#endif
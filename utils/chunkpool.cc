@@ -0,0 +1,33 @@
+#include "chunkpool.h"
+
+thread_local ChunkPool::FreeList ChunkPool::free_list_;
+
+ChunkPool::FreeList::~FreeList() {
+  while (head) {
+    char* next = *reinterpret_cast<char**>(head);
+    delete[] head;
+    head = next;
+  }
+}
+
+char* ChunkPool::Alloc() {
+  FreeList& list = free_list_;
+  if (!list.head) {
+    return new char[kChunkSize];
+  }
+  char* chunk = list.head;
+  list.head = *reinterpret_cast<char**>(chunk);
+  list.count--;
+  return chunk;
+}
+
+void ChunkPool::Free(char* chunk) {
+  FreeList& list = free_list_;
+  if (list.count >= kMaxFree) {
+    delete[] chunk;
+    return;
+  }
+  *reinterpret_cast<char**>(chunk) = list.head;
+  list.head = chunk;
+  list.count++;
+}
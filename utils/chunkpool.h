@@ -0,0 +1,28 @@
+#ifndef CHUNKPOOL_H
+#define CHUNKPOOL_H
+
+#include <stddef.h>
+
+/* 固定大小的内存块，供缓冲区使用，每个线程一个空闲链表，分配和归还都不加锁
+块可以在一个线程分配、在另一个线程归还，归还到当前线程的链表；
+每个线程最多保留kMaxFree个空闲块，多出的直接释放
+*/
+class ChunkPool {
+ public:
+  static const size_t kChunkSize = 4096;
+  static const int kMaxFree = 256;
+
+  static char* Alloc();
+  static void Free(char* chunk);
+
+ private:
+  struct FreeList {
+    FreeList() : head(nullptr), count(0) {}
+    ~FreeList();
+    char* head;  // 空闲块的前几个字节存放下一个空闲块的地址
+    int count;
+  };
+  static thread_local FreeList free_list_;
+};
+
+#endif
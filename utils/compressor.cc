@@ -0,0 +1,76 @@
+#include "compressor.h"
+
+bool Compressor::Compress(ENCODING encoding, const char* data, size_t len,
+                          std::string* out) {
+  switch (encoding) {
+    case ENCODING_GZIP:
+      return Gzip(data, len, out);
+    case ENCODING_BR:
+      return Brotli(data, len, out);
+    default:
+      return false;
+  }
+}
+
+const char* Compressor::GetName(ENCODING encoding) {
+  switch (encoding) {
+    case ENCODING_GZIP:
+      return "gzip";
+    case ENCODING_BR:
+      return "br";
+    default:
+      return "identity";
+  }
+}
+
+const char* Compressor::GetSuffix(ENCODING encoding) {
+  switch (encoding) {
+    case ENCODING_GZIP:
+      return ".gz";
+    case ENCODING_BR:
+      return ".br";
+    default:
+      return "";
+  }
+}
+
+/* 文件在后台线程中压缩，之后一直使用缓存的结果；
+最高级别比中等级别多花几十倍时间，压缩率只高几个百分点，使用中等级别
+*/
+bool Compressor::Gzip(const char* data, size_t len, std::string* out) {
+  z_stream stream = {};
+  // windowBits加16输出gzip格式而不是zlib格式
+  if (deflateInit2(&stream, kGzipLevel, Z_DEFLATED, 15 + 16, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  size_t begin = out->size();
+  out->resize(begin + deflateBound(&stream, len));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream.avail_in = len;
+  stream.next_out = reinterpret_cast<Bytef*>(&(*out)[begin]);
+  stream.avail_out = out->size() - begin;
+  int ret = deflate(&stream, Z_FINISH);
+  out->resize(begin + stream.total_out);
+  deflateEnd(&stream);
+  return ret == Z_STREAM_END;
+}
+
+bool Compressor::Brotli(const char* data, size_t len, std::string* out) {
+  size_t begin = out->size();
+  size_t out_len = BrotliEncoderMaxCompressedSize(len);
+  if (out_len == 0) {
+    return false;
+  }
+  out->resize(begin + out_len);
+  if (!BrotliEncoderCompress(kBrotliQuality, BROTLI_DEFAULT_WINDOW,
+                             BROTLI_MODE_TEXT,
+                             len, reinterpret_cast<const uint8_t*>(data),
+                             &out_len,
+                             reinterpret_cast<uint8_t*>(&(*out)[begin]))) {
+    out->resize(begin);
+    return false;
+  }
+  out->resize(begin + out_len);
+  return true;
+}
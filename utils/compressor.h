@@ -0,0 +1,38 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <brotli/encode.h>
+#include <zlib.h>
+
+#include <string>
+
+/* 静态资源的内容编码
+每种编码对应一个文件后缀，预压缩的文件与原文件放在同一目录，如main.css.gz
+*/
+class Compressor {
+ public:
+  enum ENCODING {
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP,
+    ENCODING_BR,
+    ENCODING_COUNT,
+  };
+
+  /* 压缩data，结果追加到out，失败返回false */
+  static bool Compress(ENCODING encoding, const char* data, size_t len,
+                       std::string* out);
+
+  // 编码名，用于Content-Encoding
+  static const char* GetName(ENCODING encoding);
+  // 预压缩文件的后缀
+  static const char* GetSuffix(ENCODING encoding);
+
+ private:
+  static const int kGzipLevel = 6;
+  static const int kBrotliQuality = 5;
+
+  static bool Gzip(const char* data, size_t len, std::string* out);
+  static bool Brotli(const char* data, size_t len, std::string* out);
+};
+
+#endif
@@ -20,7 +20,7 @@ int Epoller::Wait(int timeout) {
 /* 获取对应索引的时间描述符fd */
 int Epoller::GetEventFd(size_t i) const {
   assert(i < events_.size() && i >= 0);
-  return events_[i].data.fd;
+  return static_cast<int>(events_[i].data.u64 & 0xffffffff);
 }
 
 /* 获取对应索引的时间类型events */
@@ -29,11 +29,17 @@ uint32_t Epoller::GetEventsType(size_t i) const {
   return events_[i].events;
 }
 
+/* 获取注册该事件时的generation */
+uint32_t Epoller::GetEventGeneration(size_t i) const {
+  assert(i < events_.size() && i >= 0);
+  return static_cast<uint32_t>(events_[i].data.u64 >> 32);
+}
+
 /* 注册事件 */
-bool Epoller::AddFd(int fd, uint32_t events) {
+bool Epoller::AddFd(int fd, uint32_t events, uint32_t generation) {
   if (fd < 0) return false;
   epoll_event ev = {0};
-  ev.data.fd = fd;
+  ev.data.u64 = (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
   ev.events = events;
   int ret = epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev);
   // std::cout << errno << std::endl;
@@ -52,10 +58,10 @@ bool Epoller::DelFd(int fd) {
 }
 
 /* 修改事件 */
-bool Epoller::ModFd(int fd, uint32_t events) {
+bool Epoller::ModFd(int fd, uint32_t events, uint32_t generation) {
   if (fd < 0) return false;
   epoll_event ev = {0};
-  ev.data.fd = fd;
+  ev.data.u64 = (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
   ev.events = events;
   return 0 == epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev);
 }
\ No newline at end of file
@@ -15,9 +15,9 @@ class Epoller {
 
   ~Epoller();
 
-  bool AddFd(int fd, uint32_t events);
+  bool AddFd(int fd, uint32_t events, uint32_t generation = 0);
 
-  bool ModFd(int fd, uint32_t events);
+  bool ModFd(int fd, uint32_t events, uint32_t generation = 0);
 
   bool DelFd(int fd);
 
@@ -27,12 +27,14 @@ class Epoller {
 
   uint32_t GetEventsType(size_t i) const;
 
+  uint32_t GetEventGeneration(size_t i) const;
+
  private:
   // 内核事件表
   int epfd_;
   /* 存储从内核拷贝过来的事件
   epoll_event由events和data组成，其中events成员描述时间类型，data成员用于存储用户数据
-  data.fd指定事件所从属的目标文件描述符
+  data.u64低32位是事件所从属的目标文件描述符，高32位是连接槽位的generation
   */
 
   std::vector<struct epoll_event> events_;
@@ -0,0 +1,480 @@
+#include "filecache.h"
+
+FileCache::FileCache()
+    : max_bytes_(0),
+      used_bytes_(0),
+      invalidations_(0),
+      map_(true),
+      inotify_fd_(-1),
+      stop_fd_(-1),
+      stop_encoder_(false) {}
+
+FileCache::~FileCache() {
+  if (encoder_) {
+    {
+      std::lock_guard<std::mutex> locker(mutex_);
+      stop_encoder_ = true;
+    }
+    encode_cond_.notify_one();
+    encoder_->join();
+  }
+  if (watcher_) {
+    uint64_t one = 1;
+    ::write(stop_fd_, &one, sizeof(one));
+    watcher_->join();
+  }
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+  if (stop_fd_ >= 0) {
+    close(stop_fd_);
+  }
+}
+
+FileCache* FileCache::Instance() {
+  static FileCache instance;
+  return &instance;
+}
+
+void FileCache::Init(size_t max_bytes, const std::string& root, bool map) {
+  std::lock_guard<std::mutex> locker(mutex_);
+  max_bytes_ = max_bytes;
+  map_ = map;
+  root_ = Normalize(root);
+  if (!root_.empty() && root_.back() == '/') {
+    root_.pop_back();
+  }
+  EvictLocked();
+  if (max_bytes_ == 0 || watcher_) {
+    return;
+  }
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (inotify_fd_ < 0 || stop_fd_ < 0) {
+    // 没有inotify就无法得知文件变化，不能缓存
+    LOG_WARN("inotify init error: %d, file cache disabled", errno);
+    max_bytes_ = 0;
+    return;
+  }
+  watcher_.reset(new std::thread([this] { InotifyLoop(); }));
+  encoder_.reset(new std::thread([this] { EncodeLoop(); }));
+}
+
+FileCache::FilePtr FileCache::Get(const std::string& raw_path) {
+  // 与inotify事件中拼出的路径保持一致
+  std::string path = Normalize(raw_path);
+  FilePtr file;
+  uint64_t invalidations;
+  bool watched;
+  if (Lookup(path, &file, &invalidations, &watched)) {
+    return file;
+  }
+  // 在锁外打开和映射，不阻塞其他线程的命中
+  file = Load(path);
+  if (file && file->fd >= 0 && watched) {
+    Insert(path, file, invalidations, "", nullptr);
+  }
+  return file;
+}
+
+FileCache::FilePtr FileCache::GetEncoded(const std::string& raw_path,
+                                         const FilePtr& source,
+                                         Compressor::ENCODING encoding,
+                                         bool compress) {
+  assert(source && source->fd >= 0);
+  std::string source_path = Normalize(raw_path);
+  std::string path = source_path + Compressor::GetSuffix(encoding);
+  std::string key = EncodedKey(source_path, encoding);
+  FilePtr file;
+  uint64_t invalidations, ignored;
+  bool watched, ignored_watched;
+  if (Lookup(path, &file, &invalidations, &watched) ||
+      Lookup(key, &file, &ignored, &ignored_watched)) {
+    return file && file->fd >= 0 ? file : nullptr;
+  }
+  file = Load(path);
+  if (file && file->fd >= 0) {
+    if (watched) {
+      Insert(path, file, invalidations, "", nullptr);
+    }
+    return file;
+  }
+  if (compress) {
+    ScheduleEncode(key, source_path, source, encoding, invalidations);
+  }
+  return nullptr;
+}
+
+/* 交给后台线程压缩，同一个版本只排队一次
+不缓存时(没有后台线程)每次都要重新压缩，得不偿失，只使用预压缩文件
+*/
+void FileCache::ScheduleEncode(const std::string& key,
+                               const std::string& source_path,
+                               const FilePtr& source,
+                               Compressor::ENCODING encoding,
+                               uint64_t invalidations) {
+  {
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (!encoder_ || encoding_keys_.count(key) > 0 ||
+        encode_tasks_.size() >= kMaxEncodeTasks) {
+      return;
+    }
+    encoding_keys_.insert(key);
+    encode_tasks_.push_back(
+        EncodeTask{key, source_path, source, encoding, invalidations});
+  }
+  encode_cond_.notify_one();
+}
+
+/* 后台线程，依次压缩排队的版本并放入缓存
+压缩期间原文件发生变化时Insert不会放入，之后的请求重新排队
+*/
+void FileCache::EncodeLoop() {
+  while (true) {
+    EncodeTask task;
+    {
+      std::unique_lock<std::mutex> locker(mutex_);
+      encode_cond_.wait(locker, [this] {
+        return stop_encoder_ || !encode_tasks_.empty();
+      });
+      if (stop_encoder_) {
+        break;
+      }
+      task = std::move(encode_tasks_.front());
+      encode_tasks_.pop_front();
+    }
+    FilePtr file = Encode(task.source, task.encoding);
+    Insert(task.key, file, task.invalidations, task.source_path, task.source);
+    std::lock_guard<std::mutex> locker(mutex_);
+    encoding_keys_.erase(task.key);
+  }
+}
+
+/* 压缩生成的版本以'\0'开头，与Get使用的磁盘路径分开，请求路径不会产生这样的键 */
+std::string FileCache::EncodedKey(const std::string& source_path,
+                                  Compressor::ENCODING encoding) {
+  std::string key(1, '\0');
+  key += source_path;
+  key += Compressor::GetSuffix(encoding);
+  return key;
+}
+
+/* 查找缓存，未命中时开始监视文件所在目录，并记下当前的失效次数
+watched为false时目录没有被监视，读到的文件不能放入缓存
+*/
+bool FileCache::Lookup(const std::string& path, FilePtr* file,
+                       uint64_t* invalidations, bool* watched) {
+  std::lock_guard<std::mutex> locker(mutex_);
+  auto it = entries_.find(path);
+  if (it != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    *file = it->second.file;
+    return true;
+  }
+  // 先监视目录再读取文件，不会漏掉读取期间发生的修改
+  *watched = max_bytes_ > 0 && Watch(path);
+  *invalidations = invalidations_;
+  return false;
+}
+
+/* 放入缓存，由source生成的文件只在source仍是缓存中的那一份时放入 */
+void FileCache::Insert(const std::string& path, const FilePtr& file,
+                       uint64_t invalidations, const std::string& source_path,
+                       const FilePtr& source) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t charge = (file->st.st_size + page - 1) / page * page;
+  if (charge == 0) {
+    charge = page;
+  }
+  std::lock_guard<std::mutex> locker(mutex_);
+  // 读取期间有文件发生变化时无法确定读到的是否是旧内容，本次不缓存
+  if (charge > max_bytes_ || invalidations != invalidations_ ||
+      entries_.count(path) > 0) {
+    return;
+  }
+  if (source) {
+    auto it = entries_.find(source_path);
+    if (it == entries_.end() || it->second.file != source) {
+      return;
+    }
+  }
+  lru_.push_front(path);
+  Entry& entry = entries_[path];
+  entry.file = file;
+  entry.charge = charge;
+  entry.lru = lru_.begin();
+  used_bytes_ += charge;
+  EvictLocked();
+}
+
+void FileCache::Clear() {
+  std::lock_guard<std::mutex> locker(mutex_);
+  entries_.clear();
+  lru_.clear();
+  used_bytes_ = 0;
+  invalidations_++;
+}
+
+std::string FileCache::Normalize(const std::string& path) {
+  std::string result;
+  result.reserve(path.size());
+  for (char c : path) {
+    if (c != '/' || result.empty() || result.back() != '/') {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+
+/* 打开并映射文件 */
+FileCache::FilePtr FileCache::Load(const std::string& path) {
+  std::shared_ptr<CachedFile> file = std::make_shared<CachedFile>();
+  if (stat(path.data(), &file->st) < 0) {
+    return nullptr;
+  }
+  if (!S_ISREG(file->st.st_mode) || !(file->st.st_mode & S_IROTH)) {
+    return file;
+  }
+  file->fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+  if (file->fd < 0) {
+    return file;
+  }
+  if (file->st.st_size > 0 && map_) {
+    void* ret = mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+    if (ret == MAP_FAILED) {
+      close(file->fd);
+      file->fd = -1;
+      return file;
+    }
+    file->data = static_cast<char*>(ret);
+  }
+  SetValidators(file.get());
+  LOG_DEBUG("file cache load %s", path.data());
+  return file;
+}
+
+/* 压缩source，结果写入memfd，需要时再映射，与磁盘上的文件使用方式相同
+压缩失败或没有变小时返回fd为-1的文件，表示没有可用的编码版本
+*/
+FileCache::FilePtr FileCache::Encode(const FilePtr& source,
+                                     Compressor::ENCODING encoding) {
+  std::shared_ptr<CachedFile> file = std::make_shared<CachedFile>();
+  file->st = source->st;
+  file->st.st_size = 0;
+  size_t size = source->st.st_size;
+  if (size == 0 || size > kMaxEncodeSize) {
+    return file;
+  }
+  // 不映射时先从fd读出原文件
+  std::string in;
+  const char* data = source->data;
+  if (!data) {
+    if (!ReadAll(source, &in)) {
+      return file;
+    }
+    data = in.data();
+  }
+  std::string out;
+  if (!Compressor::Compress(encoding, data, size, &out) || out.size() >= size) {
+    return file;
+  }
+  int fd = memfd_create(Compressor::GetName(encoding), MFD_CLOEXEC);
+  if (fd < 0) {
+    return file;
+  }
+  size_t written = 0;
+  while (written < out.size()) {
+    ssize_t n = ::write(fd, out.data() + written, out.size() - written);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return file;
+    }
+    written += n;
+  }
+  if (map_) {
+    void* ret = mmap(0, out.size(), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ret == MAP_FAILED) {
+      close(fd);
+      return file;
+    }
+    file->data = static_cast<char*>(ret);
+  }
+  file->fd = fd;
+  file->st.st_size = out.size();
+  // inode和修改时间与原文件相同，大小不同，ETag自然与原文件区分开
+  SetValidators(file.get());
+  LOG_DEBUG("file cache encode %s: %zu -> %zu bytes",
+            Compressor::GetName(encoding), size, out.size());
+  return file;
+}
+
+/* 用pread读出整个文件，不改变共享fd的文件位置；文件被截断时返回false */
+bool FileCache::ReadAll(const FilePtr& file, std::string* out) {
+  size_t size = file->st.st_size;
+  out->resize(size);
+  size_t n_read = 0;
+  while (n_read < size) {
+    ssize_t n = pread(file->fd, &(*out)[n_read], size - n_read, n_read);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    n_read += n;
+  }
+  return true;
+}
+
+void FileCache::SetValidators(CachedFile* file) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\"%lx-%lx-%lx.%lx\"",
+           static_cast<unsigned long>(file->st.st_ino),
+           static_cast<unsigned long>(file->st.st_size),
+           static_cast<unsigned long>(file->st.st_mtim.tv_sec),
+           static_cast<unsigned long>(file->st.st_mtim.tv_nsec));
+  file->etag = buf;
+  struct tm tm;
+  gmtime_r(&file->st.st_mtim.tv_sec, &tm);
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  file->last_modified = buf;
+}
+
+/* 监视文件所在目录，同一目录只添加一次，目录已被监视时返回true
+只监视根目录下的目录；添加失败的目录记下来，之后直接返回false，不再重试
+*/
+bool FileCache::Watch(const std::string& path) {
+  // 压缩生成的版本与原文件在同一目录，查找原文件时已经监视
+  if (!path.empty() && path[0] == '\0') {
+    return true;
+  }
+  std::string::size_type idx = path.find_last_of('/');
+  if (idx == std::string::npos) {
+    return false;
+  }
+  std::string dir = path.substr(0, idx);
+  if (dir_watches_.count(dir) > 0) {
+    return true;
+  }
+  if (dir.compare(0, root_.size(), root_) != 0 ||
+      (dir.size() > root_.size() && dir[root_.size()] != '/') ||
+      dir.find("/..", root_.size()) != std::string::npos ||
+      failed_dirs_.count(dir) > 0) {
+    return false;
+  }
+  int wd = inotify_add_watch(
+      inotify_fd_, dir.data(),
+      IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+          IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+          IN_ONLYDIR);
+  if (wd < 0) {
+    if (failed_dirs_.size() >= kMaxFailedDirs) {
+      failed_dirs_.clear();
+    }
+    failed_dirs_.insert(dir);
+    return false;
+  }
+  dir_watches_[dir] = wd;
+  watch_dirs_[wd] = dir;
+  return true;
+}
+
+void FileCache::Erase(const std::string& path) {
+  auto it = entries_.find(path);
+  if (it == entries_.end()) {
+    return;
+  }
+  used_bytes_ -= it->second.charge;
+  lru_.erase(it->second.lru);
+  entries_.erase(it);
+}
+
+/* 文件变化时由它生成的压缩版本也要失效；
+预压缩文件出现或变化时，之前运行时压缩的版本也要让位给它
+*/
+void FileCache::EraseWithEncoded(const std::string& path) {
+  Erase(path);
+  for (int i = Compressor::ENCODING_IDENTITY + 1; i < Compressor::ENCODING_COUNT;
+       i++) {
+    Compressor::ENCODING encoding = static_cast<Compressor::ENCODING>(i);
+    std::string suffix = Compressor::GetSuffix(encoding);
+    Erase(path + suffix);
+    Erase(EncodedKey(path, encoding));
+    if (path.size() > suffix.size() &&
+        path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+      Erase(EncodedKey(path.substr(0, path.size() - suffix.size()), encoding));
+    }
+  }
+}
+
+/* 从表尾淘汰直到不超过上限，正在使用的文件由引用计数保持到响应结束 */
+void FileCache::EvictLocked() {
+  while (used_bytes_ > max_bytes_ && !lru_.empty()) {
+    Erase(lru_.back());
+  }
+}
+
+/* 后台线程，读取inotify事件使对应文件失效 */
+void FileCache::InotifyLoop() {
+  alignas(struct inotify_event) char buf[4096];
+  struct pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents) {
+      break;
+    }
+    ssize_t len;
+    while ((len = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+      std::lock_guard<std::mutex> locker(mutex_);
+      invalidations_++;
+      for (char* p = buf; p < buf + len;) {
+        struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+        p += sizeof(struct inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+          // 丢失了事件，只能全部失效
+          entries_.clear();
+          lru_.clear();
+          used_bytes_ = 0;
+          continue;
+        }
+        auto it = watch_dirs_.find(event->wd);
+        if (it == watch_dirs_.end()) {
+          continue;
+        }
+        const std::string& dir = it->second;
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+          // 目录本身不在了，清除该目录下的所有文件
+          std::string prefix = dir + "/";
+          for (auto e = entries_.begin(); e != entries_.end();) {
+            auto next = std::next(e);
+            // 压缩生成的版本跳过开头的'\0'再比较
+            size_t begin = !e->first.empty() && e->first[0] == '\0' ? 1 : 0;
+            if (e->first.compare(begin, prefix.size(), prefix) == 0) {
+              Erase(e->first);
+            }
+            e = next;
+          }
+          if (event->mask & IN_IGNORED) {
+            dir_watches_.erase(dir);
+            watch_dirs_.erase(it);
+          }
+        } else if (event->len > 0) {
+          EraseWithEncoded(dir + "/" + event->name);
+          // 新出现的子目录可能之前监视失败过
+          if ((event->mask & IN_ISDIR) &&
+              (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+            failed_dirs_.clear();
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,195 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../log/logger.h"
+#include "compressor.h"
+
+/* 缓存的文件：打开的fd、只读映射、stat结果、缓存验证器和生成好的响应头
+由shared_ptr引用计数，最后一个引用释放时才munmap和close，
+所以被淘汰或失效的文件在仍在发送它的响应结束前保持有效
+*/
+struct CachedFile {
+  static const int kHeaderSlots = 10;
+
+  CachedFile() : fd(-1), data(nullptr) {
+    st = {0};
+    for (int i = 0; i < kHeaderSlots; i++) {
+      headers[i] = nullptr;
+    }
+  }
+  ~CachedFile() {
+    if (data) {
+      munmap(data, st.st_size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    for (int i = 0; i < kHeaderSlots; i++) {
+      delete headers[i].load();
+    }
+  }
+
+  /* 取第slot个响应头，还没生成时返回nullptr */
+  inline const std::string* GetHeader(int slot) const {
+    assert(slot >= 0 && slot < kHeaderSlots);
+    return headers[slot].load(std::memory_order_acquire);
+  }
+
+  /* 保存生成的响应头，多个线程同时生成时只保留先写入的一份，返回保存的那份 */
+  const std::string* SetHeader(int slot, std::string* header) const {
+    assert(slot >= 0 && slot < kHeaderSlots);
+    std::string* expected = nullptr;
+    if (headers[slot].compare_exchange_strong(expected, header,
+                                              std::memory_order_acq_rel)) {
+      return header;
+    }
+    delete header;
+    return expected;
+  }
+
+  struct stat st;
+  int fd;      // sendfile使用，带偏移量发送不会改变文件位置，可以共享
+  char* data;  // 空文件和不映射时为nullptr
+  // 由inode、大小和修改时间生成的ETag(带引号)和Last-Modified，用于条件请求
+  std::string etag;
+  std::string last_modified;
+  // 按(状态码, keep-alive)保存的完整响应头，由HttpResponse第一次用到时生成
+  mutable std::atomic<std::string*> headers[kHeaderSlots];
+};
+
+/* 进程内共享的静态文件缓存，按完整路径索引
+同一个文件的所有并发响应共享一份映射，命中时不需要任何系统调用。
+总大小(按页向上取整)超过上限时按LRU淘汰，
+通过inotify监视缓存文件所在目录，文件被修改、删除或替换时从缓存中移除；
+只监视根目录下实际存在的目录，不在根目录下或无法监视的文件照常返回，但不缓存。
+*/
+class FileCache {
+ public:
+  typedef std::shared_ptr<const CachedFile> FilePtr;
+
+  static FileCache* Instance();
+
+  /* max_bytes为0时不缓存，每次都重新打开和映射；只缓存root目录下的文件
+  map为false时(sendfile模式)只打开文件不映射，data总是nullptr
+  */
+  void Init(size_t max_bytes, const std::string& root, bool map);
+
+  /* 获取文件，文件不存在时返回nullptr，路径中连续的'/'视为一个
+  目录和其他用户不可读的文件只返回stat结果，不打开也不缓存
+  */
+  FilePtr Get(const std::string& path);
+
+  /* 获取path处文件source的encoding编码版本，没有可用的版本时返回nullptr
+  优先使用同目录下的预压缩文件(如main.css.gz)；没有时compress为true则交给后台线程压缩一次，
+  同一个版本只排队一次，压缩完成前返回nullptr，先发送原文件。
+  结果写入memfd后映射，放入缓存时使用单独的键，Get不会取到磁盘上不存在的文件，
+  与普通文件一样按LRU淘汰，原文件变化时一起失效。
+  压缩后没有变小的也记录下来，之后不再尝试
+  */
+  FilePtr GetEncoded(const std::string& path, const FilePtr& source,
+                     Compressor::ENCODING encoding, bool compress);
+
+  void Clear();
+
+ private:
+  FileCache();
+  ~FileCache();
+
+  struct Entry {
+    FilePtr file;
+    size_t charge;
+    std::list<std::string>::iterator lru;
+  };
+
+  // 等待后台压缩的版本
+  struct EncodeTask {
+    std::string key;
+    std::string source_path;
+    FilePtr source;
+    Compressor::ENCODING encoding;
+    uint64_t invalidations;
+  };
+
+  // 超过该大小的文件不在运行时压缩
+  static const size_t kMaxEncodeSize = 4 * 1024 * 1024;
+  // 排队等待压缩的版本数上限，满了之后的请求直接发送原文件，之后再排队
+  static const size_t kMaxEncodeTasks = 64;
+  // 记住的监视失败的目录数上限，满了之后清空重新记录
+  static const size_t kMaxFailedDirs = 1024;
+
+  static std::string Normalize(const std::string& path);
+  static std::string EncodedKey(const std::string& source_path,
+                                Compressor::ENCODING encoding);
+  bool Lookup(const std::string& path, FilePtr* file, uint64_t* invalidations,
+              bool* watched);
+  void Insert(const std::string& path, const FilePtr& file,
+              uint64_t invalidations, const std::string& source_path,
+              const FilePtr& source);
+  FilePtr Load(const std::string& path);
+  FilePtr Encode(const FilePtr& source, Compressor::ENCODING encoding);
+  static bool ReadAll(const FilePtr& file, std::string* out);
+  void ScheduleEncode(const std::string& key, const std::string& source_path,
+                      const FilePtr& source, Compressor::ENCODING encoding,
+                      uint64_t invalidations);
+  void EncodeLoop();
+  static void SetValidators(CachedFile* file);
+  bool Watch(const std::string& path);
+  void Erase(const std::string& path);
+  void EraseWithEncoded(const std::string& path);
+  void EvictLocked();
+  void InotifyLoop();
+
+  std::mutex mutex_;
+  size_t max_bytes_;
+  size_t used_bytes_;
+  // 每收到一批inotify事件加一，用于发现读取文件期间发生的变化
+  uint64_t invalidations_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;  // 表头为最近使用
+
+  // 只缓存该目录下的文件，不以'/'结尾
+  std::string root_;
+  // 是否映射文件内容，sendfile模式下只用fd
+  bool map_;
+  // inotify监视描述符到目录的映射
+  int inotify_fd_;
+  int stop_fd_;
+  std::unordered_map<int, std::string> watch_dirs_;
+  std::unordered_map<std::string, int> dir_watches_;
+  // 添加监视失败的目录(多为请求了不存在的路径)，不再每次未命中都重试；
+  // 已监视的目录下新建子目录时清空
+  std::unordered_set<std::string> failed_dirs_;
+  std::unique_ptr<std::thread> watcher_;
+
+  // 后台压缩线程，与缓存共用mutex_
+  std::condition_variable encode_cond_;
+  std::deque<EncodeTask> encode_tasks_;
+  std::unordered_set<std::string> encoding_keys_;  // 排队或正在压缩的键
+  bool stop_encoder_;
+  std::unique_ptr<std::thread> encoder_;
+};
+
+#endif
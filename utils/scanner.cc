@@ -0,0 +1,105 @@
+#include "scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86
+#endif
+
+static const char* FindAnyScalar(const char* begin, const char* end,
+                                 const char* set, int n) {
+  for (; begin < end; begin++) {
+    for (int i = 0; i < n; i++) {
+      if (*begin == set[i]) {
+        return begin;
+      }
+    }
+  }
+  return end;
+}
+
+#ifdef SCANNER_X86
+/* pcmpestri一次比较16字节与最多16个待查字节，返回第一个匹配的下标 */
+__attribute__((target("sse4.2"))) static const char* FindAnySse42(
+    const char* begin, const char* end, const char* set, int n) {
+  char needles[16] = {0};
+  for (int i = 0; i < n; i++) {
+    needles[i] = set[i];
+  }
+  const __m128i set128 = _mm_loadu_si128((const __m128i*)needles);
+  while (end - begin >= 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)begin);
+    int idx = _mm_cmpestri(set128, n, block, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                               _SIDD_LEAST_SIGNIFICANT);
+    if (idx < 16) {
+      return begin + idx;
+    }
+    begin += 16;
+  }
+  return FindAnyScalar(begin, end, set, n);
+}
+
+/* 每个待查字节广播成32字节后逐个比较，结果取或，再由掩码的最低位得到位置 */
+__attribute__((target("avx2"))) static const char* FindAnyAvx2(
+    const char* begin, const char* end, const char* set, int n) {
+  __m256i set256[Scanner::kMaxSet];
+  for (int i = 0; i < n; i++) {
+    set256[i] = _mm256_set1_epi8(set[i]);
+  }
+  while (end - begin >= 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i*)begin);
+    __m256i hit = _mm256_cmpeq_epi8(block, set256[0]);
+    for (int i = 1; i < n; i++) {
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, set256[i]));
+    }
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
+  }
+  return FindAnyScalar(begin, end, set, n);
+}
+#endif
+
+static Scanner::FindAnyFunc SelectFindAny() {
+#ifdef SCANNER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return FindAnyAvx2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return FindAnySse42;
+  }
+#endif
+  return FindAnyScalar;
+}
+
+Scanner::FindAnyFunc Scanner::find_any_ = SelectFindAny();
+
+const char* Scanner::FindHeaderEnd(const char* begin, const char* end) {
+  const char* p = begin;
+  while ((p = FindByte(p, end, '\n')) != end) {
+    // \n之后紧跟\r\n或\n即为空行
+    if (p + 1 < end && p[1] == '\n') {
+      return p + 2;
+    }
+    if (p + 2 < end && p[1] == '\r' && p[2] == '\n') {
+      return p + 3;
+    }
+    p++;
+  }
+  return nullptr;
+}
+
+const char* Scanner::GetImplName() {
+#ifdef SCANNER_X86
+  if (find_any_ == FindAnyAvx2) {
+    return "avx2";
+  }
+  if (find_any_ == FindAnySse42) {
+    return "sse4.2";
+  }
+#endif
+  return "scalar";
+}
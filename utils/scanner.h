@@ -0,0 +1,41 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <assert.h>
+#include <stddef.h>
+
+/* 分隔符查找，用于在读缓冲区中切分请求
+x86上按CPU支持的指令集在启动时选择实现：AVX2每次比较32字节，SSE4.2每次16字节，
+都不支持或不是x86时逐字节查找。不足一个步长的尾部逐字节处理，不会越界读取
+*/
+class Scanner {
+ public:
+  typedef const char* (*FindAnyFunc)(const char*, const char*, const char*,
+                                     int);
+
+  // 一次最多同时查找的字节数
+  static const int kMaxSet = 4;
+
+  /* 在[begin, end)中查找第一个等于set中任一字节的位置，没有时返回end */
+  static inline const char* FindAny(const char* begin, const char* end,
+                                    const char* set, int n) {
+    assert(n > 0 && n <= kMaxSet);
+    return find_any_(begin, end, set, n);
+  }
+
+  static inline const char* FindByte(const char* begin, const char* end,
+                                     char c) {
+    return find_any_(begin, end, &c, 1);
+  }
+
+  /* 查找请求头结尾的空行(\r\n\r\n，也接受\n\n)，返回空行之后的位置，没有时返回nullptr */
+  static const char* FindHeaderEnd(const char* begin, const char* end);
+
+  /* 当前使用的实现，用于日志 */
+  static const char* GetImplName();
+
+ private:
+  static FindAnyFunc find_any_;
+};
+
+#endif
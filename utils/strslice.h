@@ -0,0 +1,28 @@
+#ifndef STRSLICE_H
+#define STRSLICE_H
+
+#include <string.h>
+#include <strings.h>  // strncasecmp
+
+#include <string>
+
+/* 一段不拥有的字节，直接指向缓冲区，不拷贝，类似string_view */
+struct StrSlice {
+  StrSlice() : data(nullptr), len(0) {}
+  StrSlice(const char* d, size_t l) : data(d), len(l) {}
+
+  inline bool Equals(const char* str) const {
+    return strlen(str) == len && memcmp(data, str, len) == 0;
+  }
+  inline bool EqualsNoCase(const char* str) const {
+    return strlen(str) == len && strncasecmp(data, str, len) == 0;
+  }
+  inline std::string ToString() const {
+    return data ? std::string(data, len) : std::string();
+  }
+
+  const char* data;
+  size_t len;
+};
+
+#endif
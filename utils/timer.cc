@@ -0,0 +1,141 @@
+#include "timer.h"
+
+/* 添加定时器，fd已有定时器时更新过期时间和回调 */
+void HeapTimer::Add(int fd, int timeout_ms, const TimeoutCallBack& cb) {
+  assert(fd >= 0);
+  if (static_cast<size_t>(fd) >= ref_.size()) {
+    ref_.resize(fd + 1, -1);
+  }
+  TimeStamp deadline = Clock::now() + MS(timeout_ms);
+  if (ref_[fd] >= 0) {
+    size_t i = ref_[fd];
+    heap_[i].cb = cb;
+    heap_[i].deadline = deadline;
+    if (deadline < heap_[i].expires) {
+      heap_[i].expires = deadline;
+      SiftUp(i);
+    }
+    return;
+  }
+  // 新节点插入队尾再上浮
+  size_t i = heap_.size();
+  ref_[fd] = i;
+  heap_.push_back({fd, deadline, deadline, cb});
+  SiftUp(i);
+}
+
+/* 连接有活动时刷新，只推迟deadline，O(1) */
+void HeapTimer::Adjust(int fd, int timeout_ms) {
+  if (fd < 0 || static_cast<size_t>(fd) >= ref_.size() || ref_[fd] < 0) {
+    return;
+  }
+  size_t i = ref_[fd];
+  heap_[i].deadline = Clock::now() + MS(timeout_ms);
+  // 超时时间变短时才需要上浮
+  if (heap_[i].deadline < heap_[i].expires) {
+    heap_[i].expires = heap_[i].deadline;
+    SiftUp(i);
+  }
+}
+
+/* 删除fd的定时器，不触发回调 */
+void HeapTimer::Remove(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= ref_.size() || ref_[fd] < 0) {
+    return;
+  }
+  Delete(ref_[fd]);
+}
+
+void HeapTimer::Clear() {
+  heap_.clear();
+  ref_.clear();
+}
+
+/* 处理到期的定时器 */
+void HeapTimer::Tick() {
+  TimeStamp now = Clock::now();
+  while (!heap_.empty()) {
+    TimerNode& node = heap_[0];
+    if (node.expires > now) {
+      break;
+    }
+    // 期间有过活动，按真实过期时间重新排序
+    if (node.deadline > now) {
+      node.expires = node.deadline;
+      SiftDown(0);
+      continue;
+    }
+    // 先出堆再回调，回调中可以安全地Add/Remove
+    TimeoutCallBack cb = std::move(node.cb);
+    Delete(0);
+    cb();
+  }
+}
+
+/* 距离最近的过期时间(ms)，没有定时器返回-1 */
+int HeapTimer::GetNextTick() {
+  Tick();
+  if (heap_.empty()) {
+    return -1;
+  }
+  auto ms = std::chrono::duration_cast<MS>(heap_[0].expires - Clock::now());
+  return ms.count() < 0 ? 0 : static_cast<int>(ms.count());
+}
+
+void HeapTimer::SiftUp(size_t i) {
+  while (i > 0) {
+    size_t parent = (i - 1) / kArity;
+    if (heap_[parent].expires <= heap_[i].expires) {
+      break;
+    }
+    SwapNode(i, parent);
+    i = parent;
+  }
+}
+
+/* 下沉，返回是否移动过 */
+bool HeapTimer::SiftDown(size_t i) {
+  size_t index = i;
+  size_t n = heap_.size();
+  while (true) {
+    size_t first = index * kArity + 1;
+    if (first >= n) {
+      break;
+    }
+    // 找出最早过期的孩子
+    size_t min_child = first;
+    size_t last = std::min(first + kArity, n);
+    for (size_t c = first + 1; c < last; c++) {
+      if (heap_[c].expires < heap_[min_child].expires) {
+        min_child = c;
+      }
+    }
+    if (heap_[index].expires <= heap_[min_child].expires) {
+      break;
+    }
+    SwapNode(index, min_child);
+    index = min_child;
+  }
+  return index > i;
+}
+
+void HeapTimer::SwapNode(size_t i, size_t j) {
+  assert(i < heap_.size() && j < heap_.size());
+  std::swap(heap_[i], heap_[j]);
+  ref_[heap_[i].fd] = i;
+  ref_[heap_[j].fd] = j;
+}
+
+/* 删除下标为i的节点：与队尾交换后弹出，再调整交换过来的节点 */
+void HeapTimer::Delete(size_t i) {
+  assert(i < heap_.size());
+  size_t n = heap_.size() - 1;
+  if (i < n) {
+    SwapNode(i, n);
+  }
+  ref_[heap_.back().fd] = -1;
+  heap_.pop_back();
+  if (i < n && !SiftDown(i)) {
+    SiftUp(i);
+  }
+}
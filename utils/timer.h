@@ -0,0 +1,56 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <assert.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+typedef std::function<void()> TimeoutCallBack;
+typedef std::chrono::steady_clock Clock;
+typedef std::chrono::milliseconds MS;
+typedef Clock::time_point TimeStamp;
+
+struct TimerNode {
+  int fd;
+  TimeStamp expires;   // 堆中排序用的过期时间
+  TimeStamp deadline;  // 实际过期时间，刷新只改这里
+  TimeoutCallBack cb;
+};
+
+/* 以fd为键的四叉小根堆定时器
+刷新(Adjust)只推迟deadline，不调整堆，O(1)；
+堆顶到期时若deadline已被推迟，再把它下沉到正确位置，否则执行回调
+堆顶的expires不晚于真实的最近过期时间，可直接用作epoll_wait的超时
+只能在所属反应堆线程中使用，不加锁
+*/
+class HeapTimer {
+ public:
+  HeapTimer() { heap_.reserve(64); }
+  ~HeapTimer() = default;
+
+  void Add(int fd, int timeout_ms, const TimeoutCallBack& cb);
+  void Adjust(int fd, int timeout_ms);
+  void Remove(int fd);
+  void Clear();
+  void Tick();
+  int GetNextTick();
+
+  inline size_t Size() const { return heap_.size(); }
+
+ private:
+  static const size_t kArity = 4;
+
+  void SiftUp(size_t i);
+  bool SiftDown(size_t i);
+  void SwapNode(size_t i, size_t j);
+  void Delete(size_t i);
+
+  std::vector<TimerNode> heap_;
+  // fd -> 堆下标，-1表示没有定时器
+  std::vector<int> ref_;
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include "uring.h"
+
+IoUring::IoUring(unsigned entries, int max_cqe)
+    : ring_fd_(-1),
+      entries_(entries),
+      sq_ptr_(MAP_FAILED),
+      sq_size_(0),
+      sqes_(nullptr),
+      sqes_size_(0),
+      sqe_tail_(0),
+      to_submit_(0),
+      cq_ptr_(MAP_FAILED),
+      cq_size_(0),
+      cqes_(max_cqe),
+      buf_ring_(nullptr),
+      buf_ring_size_(0),
+      bufs_(nullptr),
+      n_buf_(0),
+      buf_size_(0),
+      buf_tail_(0) {
+  assert(entries_ > 0 && cqes_.size() > 0);
+  memset(&params_, 0, sizeof(params_));
+}
+
+IoUring::~IoUring() {
+  if (bufs_) {
+    munmap(bufs_, static_cast<size_t>(n_buf_) * buf_size_);
+  }
+  if (buf_ring_) {
+    munmap(buf_ring_, buf_ring_size_);
+  }
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+    munmap(cq_ptr_, cq_size_);
+  }
+  if (sq_ptr_ != MAP_FAILED) {
+    munmap(sq_ptr_, sq_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+/* 创建io_uring并映射提交队列、完成队列，内核不支持时返回false */
+bool IoUring::Init() {
+  // 完成事件在下次io_uring_enter时再处理，减少对运行中线程的打断
+  params_.flags = IORING_SETUP_COOP_TASKRUN;
+  ring_fd_ = syscall(__NR_io_uring_setup, entries_, &params_);
+  if (ring_fd_ < 0 && errno == EINVAL) {
+    memset(&params_, 0, sizeof(params_));
+    ring_fd_ = syscall(__NR_io_uring_setup, entries_, &params_);
+  }
+  if (ring_fd_ < 0) {
+    return false;
+  }
+  // 需要EXT_ARG来实现带超时的等待
+  if (!(params_.features & IORING_FEAT_EXT_ARG)) {
+    return false;
+  }
+
+  sq_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+  cq_size_ =
+      params_.cq_off.cqes + params_.cq_entries * sizeof(struct io_uring_cqe);
+  if (params_.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+  }
+  sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ptr_ == MAP_FAILED) {
+    return false;
+  }
+  if (params_.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ptr_ = sq_ptr_;
+  } else {
+    cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) {
+      return false;
+    }
+  }
+  sqes_size_ = params_.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  char* sq = static_cast<char*>(sq_ptr_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+  sqe_tail_ = *sq_tail_;
+
+  char* cq = static_cast<char*>(cq_ptr_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+  cq_cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params_.cq_off.cqes);
+  return true;
+}
+
+/* 注册provided buffer ring：n_buf个大小为buf_size的缓冲区，n_buf须为2的幂 */
+bool IoUring::SetupBufRing(unsigned n_buf, unsigned buf_size, uint16_t bgid) {
+  assert(ring_fd_ >= 0 && n_buf > 0 && (n_buf & (n_buf - 1)) == 0);
+  buf_ring_size_ = n_buf * sizeof(struct io_uring_buf);
+  void* ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  buf_ring_ = static_cast<struct io_uring_buf*>(ring);
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = n_buf;
+  reg.bgid = bgid;
+  if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING,
+              &reg, 1) < 0) {
+    return false;
+  }
+
+  void* bufs = mmap(nullptr, static_cast<size_t>(n_buf) * buf_size,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufs == MAP_FAILED) {
+    return false;
+  }
+  bufs_ = static_cast<char*>(bufs);
+  n_buf_ = n_buf;
+  buf_size_ = buf_size;
+  for (unsigned i = 0; i < n_buf; i++) {
+    RecycleBuf(i);
+  }
+  return true;
+}
+
+/* 把缓冲区还给内核 */
+void IoUring::RecycleBuf(uint16_t bid) {
+  struct io_uring_buf* buf = &buf_ring_[buf_tail_ & (n_buf_ - 1)];
+  buf->addr = reinterpret_cast<uint64_t>(GetBuf(bid));
+  buf->len = buf_size_;
+  buf->bid = bid;
+  buf_tail_++;
+  // 环的tail与第一个元素的resv字段重叠
+  __atomic_store_n(&buf_ring_[0].resv, buf_tail_, __ATOMIC_RELEASE);
+}
+
+/* 取一个空闲提交项，队列满时先提交 */
+struct io_uring_sqe* IoUring::GetSqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= params_.sq_entries) {
+    Submit();
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    assert(sqe_tail_ - head < params_.sq_entries);
+  }
+  unsigned index = sqe_tail_ & *sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  sqe_tail_++;
+  to_submit_++;
+  return sqe;
+}
+
+/* 持续接受新连接，新连接直接是非阻塞的 */
+void IoUring::PrepAcceptMultishot(int listen_fd, uint64_t user_data) {
+  struct io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = user_data;
+}
+
+/* 持续接收数据，由内核从缓冲区组bgid中选取缓冲区 */
+void IoUring::PrepRecvMultishot(int fd, uint16_t bgid, uint64_t user_data) {
+  struct io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = bgid;
+  sqe->user_data = user_data;
+}
+
+/* 聚集写，iov在完成前必须保持有效
+一次只提交一个，不设置IOSQE_IO_LINK，写不完时由调用方根据完成事件提交剩余部分
+*/
+void IoUring::PrepWritev(int fd, const struct iovec* iov, int n_iov,
+                         uint64_t user_data) {
+  struct io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(iov);
+  sqe->len = n_iov;
+  sqe->user_data = user_data;
+}
+
+/* 取消fd上所有未完成的请求，须在close之前提交 */
+void IoUring::PrepCancelFd(int fd, uint64_t user_data) {
+  struct io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = user_data;
+}
+
+/* 取消user_data为target的请求，multishot请求取消后不再产生完成事件 */
+void IoUring::PrepCancel(uint64_t target, uint64_t user_data) {
+  struct io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+}
+
+/* 只提交，不等待 */
+int IoUring::Submit() {
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  int ret = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 0, 0, nullptr,
+                    0);
+  if (ret > 0) {
+    to_submit_ -= ret;
+  }
+  return ret;
+}
+
+/*
+提交所有提交项并等待至少一个完成事件，一次系统调用完成两件事
+timeout为-1时阻塞等待，返回取到的完成事件数，超时返回0
+*/
+int IoUring::Wait(int timeout_ms) {
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  // 已有完成事件时只提交不等待
+  unsigned min_complete = (head == tail) ? 1 : 0;
+  if (to_submit_ > 0 || min_complete > 0) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms >= 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+      arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+    int ret = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, min_complete,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                      sizeof(arg));
+    if (ret < 0 && errno != ETIME && errno != EINTR) {
+      return -1;
+    }
+    if (ret > 0) {
+      to_submit_ -= std::min(static_cast<unsigned>(ret), to_submit_);
+    }
+  }
+
+  // 拷贝完成事件，与Epoller的events_一样按下标访问
+  tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  int n = 0;
+  while (head != tail && n < static_cast<int>(cqes_.size())) {
+    cqes_[n++] = cq_cqes_[head & *cq_mask_];
+    head++;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  return n;
+}
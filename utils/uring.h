@@ -0,0 +1,90 @@
+#ifndef URING_H
+#define URING_H
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+/* io_uring的最小封装，直接使用系统调用，不依赖liburing
+用法与Epoller相同：Prep*填充提交项，Wait一次性提交并等待完成事件，再按下标取出完成事件
+另外管理一个provided buffer ring，供multishot recv自动选取缓冲区
+只能在一个线程中使用
+*/
+class IoUring {
+ public:
+  explicit IoUring(unsigned entries = 1024, int max_cqe = 1024);
+  ~IoUring();
+
+  bool Init();
+  bool SetupBufRing(unsigned n_buf, unsigned buf_size, uint16_t bgid);
+
+  void PrepAcceptMultishot(int listen_fd, uint64_t user_data);
+  void PrepRecvMultishot(int fd, uint16_t bgid, uint64_t user_data);
+  void PrepWritev(int fd, const struct iovec* iov, int n_iov,
+                  uint64_t user_data);
+  void PrepCancelFd(int fd, uint64_t user_data);
+  void PrepCancel(uint64_t target, uint64_t user_data);
+
+  int Submit();
+  int Wait(int timeout_ms = -1);
+
+  inline uint64_t GetCqeData(size_t i) const { return cqes_[i].user_data; }
+  inline int GetCqeRes(size_t i) const { return cqes_[i].res; }
+  inline uint32_t GetCqeFlags(size_t i) const { return cqes_[i].flags; }
+
+  /* 完成事件选中的缓冲区 */
+  inline char* GetBuf(uint16_t bid) {
+    assert(bid < n_buf_);
+    return bufs_ + static_cast<size_t>(bid) * buf_size_;
+  }
+  void RecycleBuf(uint16_t bid);
+
+ private:
+  struct io_uring_sqe* GetSqe();
+
+  int ring_fd_;
+  unsigned entries_;
+  struct io_uring_params params_;
+
+  // 提交队列
+  void* sq_ptr_;
+  size_t sq_size_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned sqe_tail_;     // 本地填充到的位置
+  unsigned to_submit_;    // 尚未提交给内核的数量
+
+  // 完成队列
+  void* cq_ptr_;
+  size_t cq_size_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  struct io_uring_cqe* cq_cqes_;
+  std::vector<struct io_uring_cqe> cqes_;
+
+  // provided buffer ring，按io_uring_buf数组访问，
+  // C++下io_uring_buf_ring中柔性数组的偏移与内核不一致，不能直接用bufs成员
+  struct io_uring_buf* buf_ring_;
+  size_t buf_ring_size_;
+  char* bufs_;
+  unsigned n_buf_;
+  unsigned buf_size_;
+  uint16_t buf_tail_;
+};
+
+#endif